@@ -0,0 +1,127 @@
+#include "blockarray.h"
+
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+const int SECTION_BLOCKS = BlockArray::SECTION * BlockArray::SECTION * BlockArray::SECTION;
+const int SECTIONS_Y = 256 / BlockArray::SECTION;
+
+
+BlockArray::BlockArray(int _xSize, int _zSize) :
+    xSize(_xSize), zSize(_zSize), ySize(256),
+    sectionsX((_xSize + SECTION - 1) / SECTION),
+    sectionsZ((_zSize + SECTION - 1) / SECTION)
+{
+    Section air = { 0, 0, vector<uint8_t>(), vector<uint8_t>() };
+    sections.assign((size_t)sectionsX * sectionsZ * SECTIONS_Y, air);
+}
+
+unsigned char BlockArray::operator()(const int x, const int y, const int z) const
+{
+    const Section &s = at(x / SECTION, y / SECTION, z / SECTION);
+    return s.bits ? s.palette[s.index(offset(x, y, z))] : s.id;
+}
+
+void BlockArray::set(const int x, const int y, const int z, const int id)
+{
+    at(x / SECTION, y / SECTION, z / SECTION).set(offset(x, y, z), id);
+}
+
+void BlockArray::fill(int x, int y, int z, int sx, int sy, int sz, int id)
+{
+    for (int cx = x / SECTION; cx <= (x + sx - 1) / SECTION; cx++)
+    for (int cz = z / SECTION; cz <= (z + sz - 1) / SECTION; cz++)
+    for (int cy = y / SECTION; cy <= (y + sy - 1) / SECTION; cy++) {
+        // the part of the box in this section
+        const int x0 = max(x, cx * SECTION), x1 = min(x + sx, (cx + 1) * SECTION);
+        const int y0 = max(y, cy * SECTION), y1 = min(y + sy, (cy + 1) * SECTION);
+        const int z0 = max(z, cz * SECTION), z1 = min(z + sz, (cz + 1) * SECTION);
+
+        Section &s = at(cx, cy, cz);
+        if ((x1 - x0) * (y1 - y0) * (z1 - z0) == SECTION_BLOCKS) {
+            s.makeUniform(id);
+            continue;
+        }
+        for (int iy = y0; iy < y1; iy++)
+        for (int iz = z0; iz < z1; iz++)
+        for (int ix = x0; ix < x1; ix++)
+            s.set(offset(ix, iy, iz), id);
+    }
+}
+
+void BlockArray::compact()
+{
+    for (auto &s : sections) {
+        if (!s.bits)
+            continue;
+        const int first = s.index(0);
+        int i = 1;
+        while (i < SECTION_BLOCKS && s.index(i) == first)
+            i++;
+        if (i == SECTION_BLOCKS)
+            s.makeUniform(s.palette[first]);
+    }
+}
+
+bool BlockArray::uniform(int sx, int sy, int sz, uint8_t *id) const
+{
+    const Section &s = at(sx, sy, sz);
+    if (s.bits)
+        return false;
+    *id = s.id;
+    return true;
+}
+
+void BlockArray::section(int sx, int sy, int sz, uint8_t *blocks) const
+{
+    const Section &s = at(sx, sy, sz);
+    if (!s.bits) {
+        memset(blocks, s.id, SECTION_BLOCKS);
+        return;
+    }
+    for (int i = 0; i < SECTION_BLOCKS; i++)
+        blocks[i] = s.palette[s.index(i)];
+}
+
+size_t BlockArray::bytes() const
+{
+    size_t n = sections.capacity() * sizeof(Section);
+    for (auto &s : sections)
+        n += s.palette.capacity() + s.indices.capacity();
+    return n;
+}
+
+
+void BlockArray::Section::set(int i, uint8_t v)
+{
+    if (!bits) {
+        if (v == id)
+            return;
+        palette.assign(1, id);
+        bits = 1;
+        indices.assign(SECTION_BLOCKS / 8, 0);
+    }
+
+    int p = find(palette.begin(), palette.end(), v) - palette.begin();
+    if (p == (int)palette.size()) {
+        // twice the bits per index
+        if (palette.size() == 1u << bits) {
+            Section old = *this;
+            bits *= 2;
+            indices.assign(SECTION_BLOCKS * bits / 8, 0);
+            for (int j = 0; j < SECTION_BLOCKS; j++)
+                setIndex(j, old.index(j));
+        }
+        palette.push_back(v);
+    }
+    setIndex(i, p);
+}
+
+void BlockArray::Section::makeUniform(uint8_t v)
+{
+    id = v;
+    bits = 0;
+    vector<uint8_t>().swap(palette);
+    vector<uint8_t>().swap(indices);
+}
@@ -0,0 +1,99 @@
+#ifndef H_BLOCKARRAY
+#define H_BLOCKARRAY
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/* block ids of a world 'xSize' x 256 x 'zSize' blocks, all 0 (air) to
+ * begin with.
+ *
+ * kept in 16x16x16 sections, the same as the exporter writes. a section
+ * that's all one block is just that id. others have a palette of the ids in
+ * them and 1, 2, 4 or 8 bit indices into it per block, as few bits as the
+ * palette allows. so mostly stone or air worlds take a fraction of the
+ * memory of one byte per block, and sections are made dense only when
+ * they're written out.
+ *
+ * reading from many threads at once is safe, as long as nothing is set.
+ */
+struct BlockArray
+{
+    static const int SECTION = 16; // blocks to a side of a section
+
+    const int xSize;
+    const int zSize;
+    const int ySize;
+
+    BlockArray(int _xSize, int _zSize);
+
+    // unchecked!
+    unsigned char operator()(const int x, const int y, const int z) const;
+
+    // unchecked!
+    void set(const int x, const int y, const int z, const int id);
+
+    // sets the box of 'sx' x 'sy' x 'sz' blocks from 'x', 'y', 'z' to 'id',
+    // whole sections at once where the box covers them. unchecked!
+    void fill(int x, int y, int z, int sx, int sy, int sz, int id);
+
+    // turns sections whose blocks all ended up the same back into one id
+    void compact();
+
+    // whether section 'sx', 'sy', 'sz' (in sections) is all one id, and
+    // which one
+    bool uniform(int sx, int sy, int sz, uint8_t *id) const;
+
+    // the 16x16x16 ids of a section in YZX order, like the exporter wants
+    void section(int sx, int sy, int sz, uint8_t *blocks) const;
+
+    // memory taken by the blocks
+    size_t bytes() const;
+
+private:
+    struct Section
+    {
+        uint8_t id; // of all blocks, if 'bits' is 0
+        uint8_t bits; // per index
+        std::vector<uint8_t> palette;
+        std::vector<uint8_t> indices; // packed, YZX order, low bits first
+
+        int index(int i) const
+        {
+            const int pos = i * bits;
+            return (indices[pos >> 3] >> (pos & 7)) & ((1 << bits) - 1);
+        }
+
+        void setIndex(int i, int v)
+        {
+            const int pos = i * bits;
+            const int mask = ((1 << bits) - 1) << (pos & 7);
+            indices[pos >> 3] = (indices[pos >> 3] & ~mask) | (v << (pos & 7) & mask);
+        }
+
+        void set(int i, uint8_t v);
+        void makeUniform(uint8_t v);
+    };
+
+    const int sectionsX, sectionsZ;
+    std::vector<Section> sections; // XZY order, like the blocks once were
+
+    const Section &at(int sx, int sy, int sz) const
+    {
+        return sections[(sx * sectionsZ + sz) * (256 / SECTION) + sy];
+    }
+
+    Section &at(int sx, int sy, int sz)
+    {
+        return sections[(sx * sectionsZ + sz) * (256 / SECTION) + sy];
+    }
+
+    // of the block at 'x', 'y', 'z' in its section
+    static int offset(int x, int y, int z)
+    {
+        return ((y % SECTION) * SECTION + z % SECTION) * SECTION + x % SECTION;
+    }
+};
+
+#endif
@@ -1,22 +1,65 @@
 #include "export.h"
+#include "fastdeflate.h"
 #include "nbt.h"
+#include "parallel.h"
 
 #include <string>
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
 #include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #define BOOST_FILESYSTEM_NO_DEPRECATED
 #include <boost/filesystem.hpp>
 using namespace std;
 using namespace boost::filesystem;
 
 
-inline void writeInt(int32_t n, FILE *out) {
-    n = __builtin_bswap32(n); fwrite(&n, 4, 1, out);
+inline void storeInt(int32_t n, uint8_t *p) {
+    n = __builtin_bswap32(n); memcpy(p, &n, 4);
 }
-inline void writeByte(int8_t n, FILE *out) {
-    fwrite(&n, 1, 1, out);
+
+const int SECTOR_SIZE = 4096; // bytes, unit of region file layout
+const int FILE_BUFFER_SIZE = 1 << 20; // stdio buffer of region files
+const char *const MANIFEST_FILE = "divinitas.manifest"; // in world dir
+
+// 64-bit FNV-1a of 'len' bytes, continuing from 'h'
+inline uint64_t hashBytes(const void *data, size_t len,
+        uint64_t h = 0xCBF29CE484222325ull)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    return h;
+}
+
+// write 'path' under another name, then rename it in place. if anything
+// fails, the old file, if there was one, is left as it was.
+template <typename F>
+ERR replaceFile(const string &path, F write)
+{
+    const string tmp = path + ".tmp";
+    ERR result = write(tmp);
+
+    boost::system::error_code ec;
+    if (result == ERR::NONE) {
+        boost::filesystem::rename(tmp, path, ec);
+        if (ec)
+            result = ERR::WRITING_CHUNKS;
+    }
+    if (result != ERR::NONE)
+        boost::filesystem::remove(tmp, ec);
+    return result;
 }
 
 
@@ -27,21 +70,170 @@ struct Vec3
 };
 
 
+/* compression backend of chunk data. compress() is called from several
+ * threads at once. the result is a zlib stream, free its data with free().
+ */
+struct Compressor
+{
+    virtual ~Compressor() { }
+    virtual buffer compress(const uint8_t *data, size_t len) const = 0;
+    // same without zlib's header and checksum, a bare deflate stream.
+    // unless 'last' it ends on a byte boundary, so that more can follow.
+    virtual buffer compressRaw(const uint8_t *data, size_t len, bool last = true) const = 0;
+    virtual string name() const = 0;
+
+    static Compressor *create(const CompressionOptions &options);
+};
+
+struct ZlibCompressor : Compressor
+{
+    int level;
+    int strategy;
+
+    ZlibCompressor(int _level, int _strategy = Z_DEFAULT_STRATEGY) :
+        level(_level), strategy(_strategy)
+    { }
+
+    buffer compress(const uint8_t *data, size_t len) const
+    {
+        return compress_zlib(data, len, level, strategy);
+    }
+
+    buffer compressRaw(const uint8_t *data, size_t len, bool last = true) const
+    {
+        return compress_zlib(data, len, level, strategy, -15,
+                last ? Z_FINISH : Z_SYNC_FLUSH);
+    }
+
+    string name() const
+    {
+        ostringstream oss;
+        oss << (strategy == Z_RLE ? "zlib rle " : "zlib ") << level;
+        return oss.str();
+    }
+};
+
+struct FastDeflateCompressor : Compressor
+{
+    buffer compress(const uint8_t *data, size_t len) const
+    {
+        buffer b = allocate(len);
+        if (b.data)
+            b.len = fast_deflate_zlib(data, len, b.data);
+        return b;
+    }
+
+    buffer compressRaw(const uint8_t *data, size_t len, bool last = true) const
+    {
+        buffer b = allocate(len);
+        if (b.data)
+            b.len = fast_deflate_raw(data, len, b.data, last);
+        return b;
+    }
+
+    static buffer allocate(size_t len)
+    {
+        buffer b = { NULL, 0, fast_deflate_bound(len) };
+        b.data = (unsigned char*)malloc(b.cap);
+        if (!b.data)
+            b.cap = 0;
+        return b;
+    }
+
+    string name() const { return "fast deflate"; }
+};
+
+Compressor *Compressor::create(const CompressionOptions &options)
+{
+    switch (options.method) {
+    case ZLIB_RLE:
+        return new ZlibCompressor(options.level, Z_RLE);
+    case FAST_DEFLATE:
+        return new FastDeflateCompressor();
+    case ZLIB:
+    default:
+        return new ZlibCompressor(options.level);
+    }
+}
+
+
+/* part of a chunk's NBT as a bare deflate stream. a chunk's zlib stream
+ * may be strung together from several pieces compressed on their own, all
+ * but the last of which end on a byte boundary, without a final block.
+ */
+struct DeflatedPiece
+{
+    buffer deflated;
+    uint32_t adler; // of the uncompressed data
+    size_t len; // uncompressed
+
+    static DeflatedPiece compress(const Compressor &c, const uint8_t *data,
+            size_t len, bool last)
+    {
+        DeflatedPiece p;
+        p.deflated = c.compressRaw(data, len, last);
+        p.adler = adler32(adler32(0, NULL, 0), data, len);
+        p.len = len;
+        return p;
+    }
+};
+
+// zlib stream of 'headLen' bytes at 'head', in a stored block, followed by
+// 'body'. free its data with free().
+static buffer zlibStream(const uint8_t *head, size_t headLen, const DeflatedPiece &body)
+{
+    // well below a stored block's 64K
+    const size_t storedLen = headLen ? 5 + headLen : 0;
+    buffer b = { NULL, 0, 2 + storedLen + body.deflated.len + 4 };
+    b.data = (unsigned char*)malloc(b.cap);
+    if (!b.data) {
+        b.cap = 0;
+        return b;
+    }
+
+    uint8_t *o = b.data;
+    *o++ = 0x78; *o++ = 0x9C; // deflate, 32K window, default level
+    if (headLen) {
+        *o++ = 0; // stored block, not the last one
+        *o++ = headLen; *o++ = headLen >> 8;
+        *o++ = ~headLen; *o++ = ~headLen >> 8;
+        memcpy(o, head, headLen);
+        o += headLen;
+    }
+    memcpy(o, body.deflated.data, body.deflated.len);
+    o += body.deflated.len;
+
+    uint32_t adler = adler32(adler32(0, NULL, 0), head, headLen);
+    storeInt(adler32_combine(adler, body.adler, body.len), o);
+    b.len = b.cap;
+    return b;
+}
+
+
+struct ChunkCache;
+struct SectionCache;
+
 struct WorldParams
 {
     const int sizeX, sizeZ, startX, startZ; // in chunks
-    ChunkCallback chunkCB;
-    SectionCallback sectionCB;
+    const Generator *generator;
+    const Compressor *compressor;
+    ChunkCache *cache; // NULL if chunks aren't fingerprinted
+    SectionCache *sections; // NULL if sections aren't cached
 
     // dimensions in chunks
-    WorldParams(int _size, ChunkCallback _chunkCB, SectionCallback _sectionCB) :
+    WorldParams(int _size, const Generator *_generator,
+            const Compressor *_compressor = NULL, ChunkCache *_cache = NULL,
+            SectionCache *_sections = NULL) :
         sizeX(_size),
         sizeZ(_size),
         // center world on origin
         startX(-(_size/2)),
         startZ(-(_size/2)),
-        chunkCB(_chunkCB),
-        sectionCB(_sectionCB)
+        generator(_generator),
+        compressor(_compressor),
+        cache(_cache),
+        sections(_sections)
     { }
 };
 
@@ -174,7 +366,7 @@ struct MCAChunkSection
         uint8_t *BlockLight = allocate_byte_array(BLOCKLIGHT_SIZE);
         uint8_t *SkyLight = allocate_byte_array(SKYLIGHT_SIZE);
 
-        params->sectionCB(xPos - params->startX, yPos, zPos - params->startZ, Blocks, Data, BlockLight, SkyLight);
+        params->generator->section(xPos - params->startX, yPos, zPos - params->startZ, Blocks, Data, BlockLight, SkyLight);
 
         // important to use NULL for name when it'll be a tag_list entry
         return tag_compound(NULL, NBTList()
@@ -185,19 +377,87 @@ struct MCAChunkSection
                 << tag_byte_array_allocated("SkyLight",SKYLIGHT_SIZE,SkyLight)
                 );
     }
+
+    // same as toNBT() but written straight into 'w', as a list entry
+    void writeNBT(NBTWriter &w)
+    {
+        // arrays and their tags, so that the pointers below stay valid
+        w.reserve(BLOCKS_SIZE + DATA_SIZE + BLOCKLIGHT_SIZE + SKYLIGHT_SIZE + 128);
+
+        w.tagByte("Y",yPos);
+        uint8_t *Blocks = w.tagByteArray("Blocks",BLOCKS_SIZE);
+        uint8_t *Data = w.tagByteArray("Data",DATA_SIZE);
+        uint8_t *BlockLight = w.tagByteArray("BlockLight",BLOCKLIGHT_SIZE);
+        uint8_t *SkyLight = w.tagByteArray("SkyLight",SKYLIGHT_SIZE);
+
+        params->generator->section(xPos - params->startX, yPos, zPos - params->startZ, Blocks, Data, BlockLight, SkyLight);
+        w.endCompound();
+    }
 };
 
 
-struct MCAChunk
+/* compressed sections for those that Generator::sectionKey() says are the same
+ * in many chunks. runs of sections with the same key are compressed once,
+ * together, as a piece of a chunk's deflate stream, and spliced into every
+ * chunk that has the run.
+ */
+struct SectionCache
 {
-    typedef vector<MCAChunkSection*> SectionsList;
+    struct Run
+    {
+        uint32_t key;
+        int y, count; // sections y .. y + count - 1
+
+        bool operator<(const Run &r) const
+        {
+            return key != r.key ? key < r.key : y != r.y ? y < r.y : count < r.count;
+        }
+    };
+
+    mutex lock;
+    map<Run, DeflatedPiece> pieces;
+
+    ~SectionCache()
+    {
+        for (auto &p : pieces)
+            free(p.second.deflated.data);
+    }
+
+    // piece of run 'r' of the chunk at 'xPos', 'zPos'. NULL data if
+    // compression failed.
+    const DeflatedPiece &get(const Run &r, int xPos, int zPos, WorldParams *params)
+    {
+        {
+            lock_guard<mutex> lk(lock);
+            auto it = pieces.find(r);
+            if (it != pieces.end())
+                return it->second;
+        }
 
+        // per thread, so the buffer is allocated only a few times
+        static thread_local NBTWriter nbt;
+        nbt.clear();
+        for (int y = r.y; y < r.y + r.count; y++)
+            MCAChunkSection(xPos, y, zPos, params).writeNBT(nbt);
+        DeflatedPiece p = DeflatedPiece::compress(*params->compressor,
+                &nbt.data[0], nbt.data.size(), false);
+
+        lock_guard<mutex> lk(lock);
+        auto it = pieces.emplace(r, p);
+        if (!it.second)
+            free(p.deflated.data); // another thread got there first
+        return it.first->second;
+    }
+};
+
+
+struct MCAChunk
+{
     WorldParams *params;
     int32_t xPos;
     int32_t zPos;
     int64_t LastUpdate;
     int8_t TerrainPopulated;
-    SectionsList Sections;
     //Entities
     //TileEntities
 
@@ -206,17 +466,17 @@ struct MCAChunk
         xPos(x),
         zPos(z),
         LastUpdate(0),
-        TerrainPopulated(1),
-        Sections()
-    {
-        for (int i=0; i<MAX_SECTIONS; i++)
-            Sections.push_back(new MCAChunkSection(xPos, i, zPos, params));
-    }
+        TerrainPopulated(1)
+    { }
 
-    ~MCAChunk()
+    // number of sections up to and including the highest non-air block.
+    // sections above that are all air, which is what the game assumes of
+    // missing sections, so they're left out.
+    static int sectionCount(int topY)
     {
-        for (SectionsList::iterator it=Sections.begin(); it!=Sections.end(); ++it)
-            delete (*it);
+        if (topY < 0)
+            return 0;
+        return min(topY / SECTION_HEIGHT + 1, MAX_SECTIONS);
     }
 
     nbt_node* toNBT()
@@ -227,11 +487,11 @@ struct MCAChunk
         Biomes = allocate_byte_array(BIOMES_SIZE);
         HeightMap = allocate_int_array(HEIGHTMAP_SIZE);
 
-        params->chunkCB(xPos - params->startX, zPos - params->startZ, Biomes, HeightMap);
+        int topY = params->generator->chunk(xPos - params->startX, zPos - params->startZ, Biomes, HeightMap);
 
         NBTList sectlist;
-        for (SectionsList::iterator it=Sections.begin(); it!=Sections.end(); ++it)
-            sectlist << (*it)->toNBT();
+        for (int i = 0; i < sectionCount(topY); i++)
+            sectlist << MCAChunkSection(xPos, i, zPos, params).toNBT();
 
         nbt_node *start = tag_compound("Level", NBTList()
                 << tag_int("xPos",xPos)
@@ -246,6 +506,351 @@ struct MCAChunk
         // wrap it in a root tag
         return tag_compound("", NBTList() << start);
     }
+
+    // tags up to the chunk's position, the only part of the NBT that
+    // differs between chunks with the same fingerprint
+    void writeHeadNBT(NBTWriter &w)
+    {
+        w.beginCompound(""); // root tag
+        w.beginCompound("Level");
+        w.tagInt("xPos",xPos);
+        w.tagInt("zPos",zPos);
+    }
+
+    // a section that was left out of the NBT, to be spliced in compressed
+    struct Splice
+    {
+        size_t offset; // where it goes in the NBT
+        const DeflatedPiece *piece;
+    };
+
+    // same as toNBT() but written straight into 'w' without a node tree.
+    // if 'splices' is given, sections found in params->sections are left
+    // out and added to it instead.
+    void writeNBT(NBTWriter &w, vector<Splice> *splices = NULL)
+    {
+        int32_t HeightMap[HEIGHTMAP_SIZE];
+
+        writeHeadNBT(w);
+        w.tagLong("LastUpdate",LastUpdate);
+        w.tagByte("TerrainPopulated",TerrainPopulated);
+        uint8_t *Biomes = w.tagByteArray("Biomes",BIOMES_SIZE);
+        int topY = params->generator->chunk(xPos - params->startX, zPos - params->startZ, Biomes, HeightMap);
+        w.tagIntArray("HeightMap",HEIGHTMAP_SIZE,HeightMap);
+
+        // cNBT tags an empty list as a list of bytes, do the same
+        const int numSections = sectionCount(topY);
+        w.beginList("Sections",numSections ? TAG_COMPOUND : TAG_BYTE,numSections);
+        for (int i = 0; i < numSections; ) {
+            SectionCache::Run run = { sectionKey(i, splices), i, 1 };
+            if (!run.key) {
+                MCAChunkSection(xPos, i++, zPos, params).writeNBT(w);
+                continue;
+            }
+
+            while (i + run.count < numSections && sectionKey(i + run.count, splices) == run.key)
+                run.count++;
+            Splice s = { w.data.size(), &params->sections->get(run, xPos, zPos, params) };
+            splices->push_back(s);
+            i += run.count;
+        }
+
+        w.endCompound(); // Level
+        w.endCompound(); // root
+    }
+
+    uint32_t sectionKey(int y, const vector<Splice> *splices) const
+    {
+        if (!splices || !params->sections)
+            return 0;
+        return params->generator->sectionKey(xPos - params->startX, y, zPos - params->startZ);
+    }
+
+    // the NBT in 'w' from 'from' on, with 'splices' spliced in, compressed
+    // as one deflate stream
+    DeflatedPiece compressSpliced(const NBTWriter &w, size_t from,
+            const vector<Splice> &splices)
+    {
+        const Compressor &c = *params->compressor;
+        if (splices.empty())
+            return DeflatedPiece::compress(c, &w.data[from], w.data.size() - from, true);
+
+        // compress what's between the splices, the last part ends the
+        // stream. it's never empty, it has the ends of the compounds.
+        struct Part { DeflatedPiece piece; bool owned; };
+        vector<Part> parts;
+        size_t pos = from;
+        for (size_t i = 0; i <= splices.size(); i++) {
+            const bool last = i == splices.size();
+            const size_t end = last ? w.data.size() : splices[i].offset;
+            if (end > pos || last) {
+                Part part = { DeflatedPiece::compress(c, &w.data[pos], end - pos, last), true };
+                parts.push_back(part);
+            }
+            if (!last) {
+                Part part = { *splices[i].piece, false };
+                parts.push_back(part);
+            }
+            pos = end;
+        }
+
+        size_t total = 0;
+        bool ok = true;
+        for (auto &p : parts) {
+            ok = ok && p.piece.deflated.data;
+            total += p.piece.deflated.len;
+        }
+
+        DeflatedPiece out = { { NULL, 0, 0 }, (uint32_t)adler32(0, NULL, 0), 0 };
+        out.deflated.data = ok ? (unsigned char*)malloc(total) : NULL;
+        if (out.deflated.data)
+            out.deflated.cap = total;
+        for (auto &p : parts) {
+            if (out.deflated.data) {
+                memcpy(out.deflated.data + out.deflated.len, p.piece.deflated.data, p.piece.deflated.len);
+                out.deflated.len += p.piece.deflated.len;
+            }
+            out.adler = adler32_combine(out.adler, p.piece.adler, p.piece.len);
+            out.len += p.piece.len;
+            if (p.owned)
+                free(p.piece.deflated.data);
+        }
+        return out;
+    }
+
+#ifdef DEBUG
+    // check that writeNBT() produced the same bytes as cNBT would
+    bool checkNBT(const NBTWriter &w)
+    {
+        nbt_node *chunknbt = toNBT();
+        buffer raw = nbt_dump_binary(chunknbt);
+        nbt_free(chunknbt);
+
+        bool same = raw.data && raw.len == w.data.size() &&
+            memcmp(raw.data, &w.data[0], raw.len) == 0;
+        if (!same)
+            cerr << "chunk " << xPos << "," << zPos << ": NBT differs from cNBT output" << endl;
+        free(raw.data);
+        return same;
+    }
+#endif
+};
+
+
+/* compressed chunks by fingerprint, shared by all regions of a world.
+ *
+ * chunks are compressed as two deflate streams one after the other: the
+ * head of the NBT (MCAChunk::writeHeadNBT()) in a stored block, then the
+ * rest of it, the body, compressed. only the body is cached, a chunk found
+ * in the cache just gets a new head. every chunk is compressed this way,
+ * so the output doesn't depend on which chunk of a kind got compressed
+ * first, and with it on the number of threads.
+ *
+ * a fingerprint is cached once it comes up a second time, so that chunks
+ * that are one of a kind don't fill the cache. fingerprints that came up
+ * are remembered in a fixed table, where a newer one takes an older one's
+ * slot, so the cache's size doesn't grow with the world.
+ */
+struct ChunkCache
+{
+    static const size_t MAX_BYTES = 64 << 20; // all of the entries
+    static const size_t SEEN_SLOTS = 1 << 16; // power of two
+    static const size_t NODE_BYTES = 4 * sizeof(void*); // map's per entry
+
+    struct Entry
+    {
+        int32_t fingerprint[FINGERPRINT_SIZE]; // in case hashes collide
+        DeflatedPiece body;
+    };
+
+    mutex lock;
+    vector<uint64_t> seen; // hashes of fingerprints, by their low bits
+    unordered_map<uint64_t, Entry> bodies; // by hash of fingerprint
+    size_t bytes; // entries and their bodies
+
+    ChunkCache() : seen(SEEN_SLOTS), bytes(0) { }
+
+    ~ChunkCache()
+    {
+        for (auto &b : bodies)
+            free(b.second.body.deflated.data);
+    }
+
+    // zlib stream of 'chunk'. 'nbt' is scratch space.
+    buffer compress(MCAChunk &chunk, NBTWriter &nbt)
+    {
+        const WorldParams *p = chunk.params;
+        int32_t fingerprint[FINGERPRINT_SIZE];
+        p->generator->fingerprint(chunk.xPos - p->startX, chunk.zPos - p->startZ, fingerprint);
+        const uint64_t key = hashBytes(fingerprint, sizeof fingerprint);
+
+        nbt.clear();
+        chunk.writeHeadNBT(nbt);
+        const size_t headLen = nbt.data.size();
+        {
+            lock_guard<mutex> lk(lock);
+            auto it = bodies.find(key);
+            if (it != bodies.end() && memcmp(it->second.fingerprint,
+                    fingerprint, sizeof fingerprint) == 0)
+                return zlibStream(&nbt.data[0], headLen, it->second.body);
+        }
+
+        static thread_local vector<MCAChunk::Splice> splices;
+        splices.clear();
+        nbt.clear();
+        chunk.writeNBT(nbt, &splices);
+        DeflatedPiece body = chunk.compressSpliced(nbt, headLen, splices);
+        if (!body.deflated.data)
+            return body.deflated;
+
+        buffer b = zlibStream(&nbt.data[0], headLen, body);
+        if (!add(key, fingerprint, body))
+            free(body.deflated.data);
+        return b;
+    }
+
+    // returns whether the cache took the body
+    bool add(uint64_t key, const int32_t *fingerprint, const DeflatedPiece &body)
+    {
+        lock_guard<mutex> lk(lock);
+        uint64_t &slot = seen[(key ^ key >> 32) & (SEEN_SLOTS - 1)];
+        if (slot != key) {
+            slot = key;
+            return false; // first one of its kind, as far as we know
+        }
+        const size_t size = sizeof(Entry) + NODE_BYTES + body.deflated.len;
+        if (bytes + size > MAX_BYTES)
+            return false;
+        auto it = bodies.emplace(key, Entry());
+        if (!it.second)
+            return false; // another thread got there first, or a collision
+        memcpy(it.first->second.fingerprint, fingerprint,
+                sizeof it.first->second.fingerprint);
+        it.first->second.body = body;
+        bytes += size;
+        return true;
+    }
+
+};
+
+
+#ifdef DEBUG
+// check that 'buf' inflates to the NBT in 'w'
+static bool inflatesTo(const buffer &buf, const NBTWriter &w)
+{
+    vector<uint8_t> raw(w.data.size() + 1);
+    uLongf len = raw.size();
+    bool same = buf.data &&
+        uncompress(&raw[0], &len, buf.data, buf.len) == Z_OK &&
+        len == w.data.size() && memcmp(&raw[0], &w.data[0], len) == 0;
+    if (!same)
+        cerr << "chunk doesn't inflate to its NBT" << endl;
+    return same;
+}
+#endif
+
+
+/* writes compressed chunks into a region file in chunk order while later
+ * chunks are still being generated and compressed. producers may finish in
+ * any order; whoever hands in the next chunk in line writes it and all the
+ * ready ones after it. a chunk may only start once it is less than
+ * WRITE_WINDOW chunks ahead of the next one to be written, so memory use is
+ * bounded by the window, not by the region size.
+ */
+struct RegionWriter
+{
+    static const int WRITE_WINDOW = 128; // chunks
+
+    FILE *outfile;
+    ERR result;
+    uint32_t currentOffset; // sectors
+    vector<int32_t> locations; // per chunk, in the order they're written
+    int next; // index of the next chunk to write
+    bool writing; // some thread is writing chunks right now
+    buffer window[WRITE_WINDOW];
+    bool ready[WRITE_WINDOW];
+    mutex lock;
+    condition_variable space;
+
+    RegionWriter(FILE *_outfile, int numChunks) :
+        outfile(_outfile),
+        result(ERR::NONE),
+        currentOffset(2), // after the header
+        locations(numChunks, 0),
+        next(0),
+        writing(false)
+    {
+        for (int i = 0; i < WRITE_WINDOW; i++)
+            ready[i] = false;
+    }
+
+    // wait until chunk 'i' fits in the window. returns false if writing has
+    // already failed and the chunk needn't be produced at all.
+    bool reserve(int i)
+    {
+        unique_lock<mutex> lk(lock);
+        space.wait(lk, [&] { return i < next + WRITE_WINDOW; });
+        return result == ERR::NONE;
+    }
+
+    // hand in compressed chunk 'i' (NULL data if it failed or was skipped)
+    // and write whatever is ready, in order. takes ownership of 'buf'.
+    void finish(int i, buffer buf)
+    {
+        unique_lock<mutex> lk(lock);
+        window[i % WRITE_WINDOW] = buf;
+        ready[i % WRITE_WINDOW] = true;
+        if (writing)
+            return; // the writing thread will pick it up
+
+        writing = true;
+        while (ready[next % WRITE_WINDOW]) {
+            buffer out = window[next % WRITE_WINDOW];
+            ready[next % WRITE_WINDOW] = false;
+            const bool skip = result != ERR::NONE;
+
+            lk.unlock();
+            ERR err = skip ? ERR::NONE : write(next, out);
+            free(out.data);
+            lk.lock();
+
+            if (err != ERR::NONE)
+                result = err;
+            next++;
+            space.notify_all();
+        }
+        writing = false;
+    }
+
+    ERR write(int i, const buffer &buf)
+    {
+        if (buf.data == NULL)
+            return ERR::NBT_ERROR;
+
+        static const uint8_t zeros[SECTOR_SIZE] = {};
+
+        // check that the file is where the previous chunks say it should be
+        unsigned long pos = ftell(outfile);
+        if (pos != currentOffset * SECTOR_SIZE)
+            return ERR::WRITING_CHUNKS;
+
+        uint8_t numSectors = (buf.len + 5 + SECTOR_SIZE - 1)/SECTOR_SIZE;
+        locations[i] = (currentOffset << 8) | numSectors;
+        currentOffset += numSectors; // offset for next chunk
+
+        // chunk data length and compression type, the data, and zeroes up
+        // to the end of the last sector. these go into the file's buffer,
+        // which is flushed in big blocks.
+        uint8_t head[5];
+        storeInt(buf.len + 1, head);
+        head[4] = 2;
+        size_t padding = numSectors * SECTOR_SIZE - (buf.len + 5);
+        if (fwrite(head, 1, 5, outfile) != 5 ||
+            fwrite(buf.data, 1, buf.len, outfile) != buf.len ||
+            fwrite(zeros, 1, padding, outfile) != padding)
+            return ERR::WRITING_CHUNKS;
+        return ERR::NONE;
+    }
 };
 
 
@@ -255,14 +860,12 @@ struct Region
     // region coords (i.e. blocks/32)
     int xIndex;
     int zIndex;
-    // start of 'chunks' array in absolute chunk coords
+    // start of chunks in absolute chunk coords
     int startX;
     int startZ;
-    // dimensions of 'chunks' array
+    // dimensions in chunks
     int sizeX;
     int sizeZ;
-    // 2d array of pointers: ZX order
-    MCAChunk **chunks;
 
     Region(const int _xIndex, const int _zIndex, WorldParams *p) :
         params(p),
@@ -271,8 +874,7 @@ struct Region
         startX(_xIndex * REGION_WIDTH),
         startZ(_zIndex * REGION_WIDTH),
         sizeX(REGION_WIDTH),
-        sizeZ(REGION_WIDTH),
-        chunks(NULL)
+        sizeZ(REGION_WIDTH)
     {
         // bounds adjustment
         if (startX < p->startX) {
@@ -295,122 +897,160 @@ struct Region
             sizeZ = 0;
             startX = 0;
             startZ = 0;
-            chunks = NULL;
-        } else {
-            // create chunks
-            chunks = new MCAChunk*[sizeZ * sizeX];
-            for (int i = 0; i < sizeZ * sizeX; i++)
-                chunks[i] = NULL;
-            for (int iz = 0; iz < sizeZ; iz++)
-            for (int ix = 0; ix < sizeX; ix++) {
-                chunks[iz * sizeX + ix] = new MCAChunk(startX + ix, startZ + iz, p);
-            }
-
         }
     }
 
-    ~Region()
+    string fileName() const
     {
-        if (chunks) {
-            for (int i = 0; i < sizeZ * sizeX; i++)
-                if (chunks[i])
-                    delete chunks[i];
-            delete[] chunks;
-        }
+        ostringstream oss;
+        oss << "r." << xIndex << "." << zIndex << ".mca";
+        return oss.str();
     }
 
-    ERR writeToFile() const
+    // hash of what the region file is made of: the chunks' area, their
+    // fingerprints and the compression. 0 if there are no fingerprints.
+    uint64_t inputHash() const
     {
-        // fill buffers with compressed chunk data
-        buffer bufs[sizeZ * sizeX];
-        //buffer rawbufs[sizeZ * sizeX]; // DEBUG
-        for (int i = 0; i < sizeZ * sizeX; i++) {
-            nbt_node *chunknbt = chunks[i]->toNBT();
-            bufs[i] = nbt_dump_compressed(chunknbt, STRAT_INFLATE);
-            //rawbufs[i] = nbt_dump_binary(chunknbt); // DEBUG
-            nbt_free(chunknbt);
-            if (bufs[i].data == NULL)
-                return ERR::NBT_ERROR;
+        if (!params->generator->hasFingerprints())
+            return 0;
+
+        const int32_t area[] = { startX, startZ, sizeX, sizeZ };
+        uint64_t h = hashBytes(area, sizeof area);
+        const string compression = params->compressor->name();
+        h = hashBytes(compression.data(), compression.size(), h);
+
+        int32_t fingerprint[FINGERPRINT_SIZE];
+        for (int iz = 0; iz < sizeZ; iz++)
+        for (int ix = 0; ix < sizeX; ix++) {
+            params->generator->fingerprint(startX + ix - params->startX,
+                    startZ + iz - params->startZ, fingerprint);
+            h = hashBytes(fingerprint, sizeof fingerprint, h);
         }
+        return h ? h : 1;
+    }
 
-        /*
-        // DEBUG: output uncompressed NBT for inspection
-        FILE *chunkfile = fopen("chunkNBTs", "ab");
-        for (int i = 0; i < sizeZ * sizeX; i++)
-            fwrite(rawbufs[i].data, 1, rawbufs[i].len, chunkfile);
-        fclose(chunkfile);
-        */
-
-        // build filename
-        ostringstream oss;
-        oss << "r." << xIndex << "." << zIndex << ".mca";
-        string filename = oss.str();
+    // replaces the file in 'dir' as a whole, an existing file stays as it
+    // was until the new one is complete
+    ERR writeToFile(const path &dir) const
+    {
+        return replaceFile((dir / fileName()).string(), [this](const string &filename) {
+            return write(filename);
+        });
+    }
 
+    ERR write(const string &filename) const
+    {
         // open file
-        ERR result = ERR::NONE;
         FILE *outfile = fopen(filename.c_str(), "wb");
-        if (!outfile) {
-            result = ERR::OPEN_FILE;
-        } else {
-            // write file
-            uint32_t currentOffset = 2; // sectors
-            uint32_t offsets[sizeZ * sizeX];
-
-            // header (8192 bytes)
-            for (int j = 0; j < 2048; j++)
-                writeInt(0, outfile);
-
-            // locations
-            const int sx = startX - xIndex * 32;
-            const int sz = startZ - zIndex * 32;
-            for (int iz = 0; iz < sizeZ; iz++)
-            for (int ix = 0; ix < sizeX; ix++) {
-                const int i = iz * sizeX + ix;
-                uint8_t numSectors = (bufs[i].len + 5 + 4095)/4096;
-                int32_t location = (currentOffset << 8) | numSectors;
-                fseek(outfile, 4 * ((sz + iz) * 32 + sx + ix), SEEK_SET);
-                writeInt(location, outfile);
-                offsets[i] = currentOffset; // store offset for later
-                currentOffset += numSectors; // offset for next chunk
-            }
-
-            // timestamps
-            /*
-            for (int i = 0; i < sizeZ * sizeX; i++)
-                writeInt(0, outfile);
-            */
-
-            // chunk data
-            fseek(outfile, 8192, SEEK_SET);
-            for (int i = 0; i < sizeZ * sizeX; i++) {
-                // check that we get same offset as before
-                // (we should, if we did our math correctly)
-                unsigned long pos = ftell(outfile);
-                if (pos != offsets[i] * 4096) {
-                    result = ERR::WRITING_CHUNKS;
-                    break;
+        if (!outfile)
+            return ERR::OPEN_FILE;
+        setvbuf(outfile, NULL, _IOFBF, FILE_BUFFER_SIZE);
+
+        // header: locations, then timestamps. it's filled in at the end,
+        // reserve space for it for now.
+        uint8_t header[2 * SECTOR_SIZE] = {};
+        fwrite(header, 1, sizeof header, outfile);
+
+        // generate, encode and compress chunks in ZX order on the worker
+        // pool. chunks are created only when their turn comes and written
+        // as soon as all chunks before them are.
+        RegionWriter writer(outfile, sizeZ * sizeX);
+        parallel_for(sizeZ * sizeX, [&](int i) {
+            buffer buf = { NULL, 0, 0 };
+            if (writer.reserve(i)) {
+                // per thread, so the buffer is allocated only a few times
+                static thread_local NBTWriter nbt;
+
+                MCAChunk chunk(startX + i % sizeX, startZ + i / sizeX, params);
+                if (params->cache) {
+                    buf = params->cache->compress(chunk, nbt);
+                } else {
+                    static thread_local vector<MCAChunk::Splice> splices;
+                    splices.clear();
+                    nbt.clear();
+                    chunk.writeNBT(nbt, &splices);
+                    if (splices.empty()) {
+                        buf = params->compressor->compress(&nbt.data[0], nbt.data.size());
+                    } else {
+                        DeflatedPiece body = chunk.compressSpliced(nbt, 0, splices);
+                        if (body.deflated.data)
+                            buf = zlibStream(NULL, 0, body);
+                        free(body.deflated.data);
+                    }
+                }
+#ifdef DEBUG
+                nbt.clear();
+                chunk.writeNBT(nbt);
+                if (!chunk.checkNBT(nbt) || !inflatesTo(buf, nbt)) {
+                    free(buf.data);
+                    buf.data = NULL;
                 }
-                // write compressed chunk data
-                writeInt(bufs[i].len + 1, outfile); // chunk data length
-                writeByte(2, outfile); // compression type
-                fwrite(bufs[i].data, 1, bufs[i].len, outfile); // actual data
-                // pad with zeroes
-                int padding = 4096 - ((bufs[i].len + 5) % 4096);
-                for (int j = 0; j < padding; j++)
-                    writeByte(0, outfile);
+#endif
             }
-
-            fclose(outfile);
+            writer.finish(i, buf);
+        });
+
+        // locations and timestamps
+        const int sx = startX - xIndex * 32;
+        const int sz = startZ - zIndex * 32;
+        const int32_t now = (int32_t)time(0);
+        for (int iz = 0; iz < sizeZ; iz++)
+        for (int ix = 0; ix < sizeX; ix++) {
+            const int j = (sz + iz) * 32 + sx + ix;
+            storeInt(writer.locations[iz * sizeX + ix], &header[4 * j]);
+            storeInt(now, &header[SECTOR_SIZE + 4 * j]);
         }
 
-        for (int i = 0; i < sizeZ * sizeX; i++)
-            free(bufs[i].data);
+        ERR result = writer.result;
+        if (result == ERR::NONE &&
+            (fseek(outfile, 0, SEEK_SET) != 0 ||
+             fwrite(header, 1, sizeof header, outfile) != sizeof header))
+            result = ERR::WRITING_CHUNKS;
 
+        if (fclose(outfile) != 0 && result == ERR::NONE)
+            result = ERR::WRITING_CHUNKS;
         return result;
     }
 };
 
 
+/* hashes of region inputs (Region::inputHash()) as of the last export,
+ * for telling which regions need rewriting when a world is updated.
+ * a text file of lines "<region file> <hash in hex>".
+ */
+struct Manifest
+{
+    map<string, uint64_t> regions;
+
+    void read(const path &file)
+    {
+        std::ifstream in(file.string().c_str());
+        string name, hash;
+        while (in >> name >> hash)
+            regions[name] = strtoull(hash.c_str(), NULL, 16);
+    }
+
+    ERR write(const path &file) const
+    {
+        return replaceFile(file.string(), [this](const string &tmp) {
+            std::ofstream out(tmp.c_str());
+            for (auto &r : regions)
+                out << r.first << " " << hex << r.second << dec << "\n";
+            out.close();
+            return out ? ERR::NONE : ERR::OPEN_FILE;
+        });
+    }
+
+    // whether region file 'name' in 'dir' was made from 'hash'
+    bool upToDate(const path &dir, const string &name, uint64_t hash) const
+    {
+        auto it = regions.find(name);
+        return hash && it != regions.end() && it->second == hash &&
+            exists(dir / name);
+    }
+};
+
+
 struct World
 {
     string name;
@@ -422,17 +1062,87 @@ struct World
         params(_params)
     { }
 
-    ERR writeToDir(const char *dirName)
+    // with 'update', the directory may exist already. only regions that
+    // aren't up to date according to its manifest are written then.
+    // paths are spelled out rather than changing the working directory,
+    // so that several worlds can be written at once.
+    ERR writeToDir(const char *dirName, bool update = false)
     {
-        if (exists(dirName))
+        const path dir(dirName);
+        const path regionDir = dir / "region";
+        if (exists(dir) && !update)
             return ERR::PATH_EXISTS;
 
-        cout << "exporting..." << endl;
+        cout << (update ? "updating..." : "exporting...") << endl;
 
         // create world dir
-        create_directory(dirName);
-        current_path(dirName);
+        create_directory(dir);
 
+        ERR result = ERR::NONE;
+        if (!update || !exists(dir / "level.dat"))
+            result = writeLevelDat(dir / "level.dat");
+        if (result != ERR::NONE)
+            return result;
+
+        Manifest manifest;
+        if (update)
+            manifest.read(dir / MANIFEST_FILE);
+
+        // create region subdir
+        create_directory(regionDir);
+
+        // write region files
+        set<string> current;
+        int skipped = 0;
+        int rgnMinX = params.startX >> 5;
+        int rgnMinZ = params.startZ >> 5;
+        int rgnMaxX = (params.startX + params.sizeX - 1) >> 5;
+        int rgnMaxZ = (params.startZ + params.sizeZ - 1) >> 5;
+        for (int iz = rgnMinZ; iz <= rgnMaxZ && result == ERR::NONE; iz++)
+        for (int ix = rgnMinX; ix <= rgnMaxX && result == ERR::NONE; ix++) {
+            // short-lived region instance
+            Region *rgn = new Region(ix, iz, &params);
+            const string filename = rgn->fileName();
+            const uint64_t hash = rgn->inputHash();
+            current.insert(filename);
+
+            if (update && manifest.upToDate(regionDir, filename, hash)) {
+                skipped++;
+            } else {
+                result = rgn->writeToFile(regionDir);
+                if (result == ERR::NONE && hash)
+                    manifest.regions[filename] = hash;
+                else if (result == ERR::NONE)
+                    manifest.regions.erase(filename);
+            }
+            delete rgn;
+        }
+
+        // regions of an earlier, larger world
+        for (auto it = manifest.regions.begin(); it != manifest.regions.end(); ) {
+            if (result == ERR::NONE && !current.count(it->first)) {
+                boost::system::error_code ec;
+                boost::filesystem::remove(regionDir / it->first, ec);
+                it = manifest.regions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (update)
+            cout << skipped << " of " << current.size() << " regions up to date" << endl;
+
+        // record what's on disk now, even if something went wrong, so the
+        // next update picks up where this one stopped. an update without
+        // fingerprints still writes it: regions it rewrote are gone from
+        // it, and must not look up to date to a later update
+        ERR manifestResult = update || params.generator->hasFingerprints() ?
+            manifest.write(dir / MANIFEST_FILE) : ERR::NONE;
+        return result != ERR::NONE ? result : manifestResult;
+    }
+
+    ERR writeLevelDat(const path &file)
+    {
         // create level.dat structure
         LevelDat *leveldat = new LevelDat();
 
@@ -442,7 +1152,7 @@ struct World
         // open level.dat for writing
         ERR result = ERR::NONE;
         nbt_status nbterr;
-        FILE *outfile = fopen("level.dat", "wb");
+        FILE *outfile = fopen(file.string().c_str(), "wb");
         if (!outfile) {
             result = ERR::OPEN_FILE;
         } else {
@@ -458,26 +1168,6 @@ struct World
             return result;
         if (nbterr != NBT_OK)
             return ERR::NBT_ERROR;
-
-        // create region subdir
-        create_directory("region");
-        current_path("region");
-
-        // write region files
-        int rgnMinX = params.startX >> 5;
-        int rgnMinZ = params.startZ >> 5;
-        int rgnMaxX = (params.startX + params.sizeX - 1) >> 5;
-        int rgnMaxZ = (params.startZ + params.sizeZ - 1) >> 5;
-        for (int iz = rgnMinZ; iz <= rgnMaxZ; iz++)
-        for (int ix = rgnMinX; ix <= rgnMaxX; ix++) {
-            // short-lived region instance
-            Region *rgn = new Region(ix, iz, &params);
-            ERR result = rgn->writeToFile();
-            delete rgn;
-            if (result != ERR::NONE)
-                return result;
-        }
-
         return ERR::NONE;
     }
 };
@@ -491,18 +1181,84 @@ ERR canExport(const char *worldName)
 }
 
 // size in chunks
-ERR exportWorld(const char *worldName, int size, ChunkCallback chunkCB, SectionCallback sectionCB)
+ERR exportWorld(const char *worldName, int size, const Generator &generator,
+        const CompressionOptions &compression, bool update)
 {
-    ERR result = canExport(worldName);
+    ERR result = update ? ERR::NONE : canExport(worldName);
     if (result != ERR::NONE)
         return result;
 
-    World *world = new World(worldName, WorldParams(size, chunkCB, sectionCB));
+    unique_ptr<Compressor> compressor(Compressor::create(compression));
+    unique_ptr<ChunkCache> cache(generator.hasFingerprints() ? new ChunkCache() : NULL);
+    unique_ptr<SectionCache> sections(new SectionCache());
+    World *world = new World(worldName, WorldParams(size, &generator,
+                compressor.get(), cache.get(), sections.get()));
 
-    result = world->writeToDir(worldName);
+    result = world->writeToDir(worldName, update);
 
     delete world;
 
     return result;
 }
 
+
+void benchmarkCompression(int size, const Generator &generator)
+{
+    // at most this many chunks, spread evenly over the world
+    const int MAX_SAMPLES = 1024;
+
+    WorldParams params(size, &generator);
+    const int numChunks = size * size;
+    const int stride = max(1, numChunks / MAX_SAMPLES);
+    const int numSamples = (numChunks + stride - 1) / stride;
+
+    cout << "serializing " << numSamples << " chunks..." << endl;
+    vector<NBTWriter> chunks(numSamples);
+    size_t totalSize = 0;
+    parallel_for(numSamples, [&](int i) {
+        const int c = i * stride;
+        MCAChunk(params.startX + c % size, params.startZ + c / size, &params).writeNBT(chunks[i]);
+    });
+    for (int i = 0; i < numSamples; i++)
+        totalSize += chunks[i].data.size();
+
+    vector<unique_ptr<Compressor> > compressors;
+    compressors.emplace_back(new ZlibCompressor(1));
+    compressors.emplace_back(new ZlibCompressor(6));
+    compressors.emplace_back(new ZlibCompressor(9));
+    compressors.emplace_back(new ZlibCompressor(1, Z_RLE));
+    compressors.emplace_back(new ZlibCompressor(6, Z_RLE));
+    compressors.emplace_back(new FastDeflateCompressor());
+
+    cout << fixed << setprecision(1);
+    cout << "method        MB/s   ratio  (" << totalSize / 1000 << " kB, one thread)" << endl;
+
+    vector<uint8_t> check;
+    for (size_t m = 0; m < compressors.size(); m++) {
+        // compress serially so that the speed is per core
+        vector<buffer> out(numSamples);
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < numSamples; i++)
+            out[i] = compressors[m]->compress(&chunks[i].data[0], chunks[i].data.size());
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        // every stream must inflate back to the chunk
+        size_t packedSize = 0;
+        bool ok = true;
+        for (int i = 0; i < numSamples; i++) {
+            const vector<uint8_t> &raw = chunks[i].data;
+            check.resize(raw.size() + 1);
+            uLongf checkLen = check.size();
+            ok = ok && out[i].data &&
+                uncompress(&check[0], &checkLen, out[i].data, out[i].len) == Z_OK &&
+                checkLen == raw.size() && memcmp(&check[0], &raw[0], raw.size()) == 0;
+            packedSize += out[i].len;
+            free(out[i].data);
+        }
+
+        cout << left << setw(12) << compressors[m]->name() << right
+             << setw(7) << totalSize / elapsed.count() / 1e6
+             << setw(8) << (double)totalSize / max(packedSize, (size_t)1)
+             << (ok ? "" : "  ROUND TRIP FAILED") << endl;
+    }
+}
@@ -20,87 +20,85 @@ const int BLOCKLIGHT_SIZE = BLOCKS_SIZE/2;
 const int SKYLIGHT_SIZE = BLOCKS_SIZE/2;
 
 
-/* should fill heightmap with 16x16 ints in ZX order and
- * biomes with 16x16 bytes in XZ order
- */
-typedef void (*ChunkCallback)(int x, int z, uint8_t *biomes, int32_t *heightmap);
+const int FINGERPRINT_SIZE = CHUNK_WIDTH * CHUNK_WIDTH + 1;
 
-/* should fill blocks with 16x16x16 bytes in YZX order and
- * data, blocklight, skylight with 16x16x16 half-bytes in YZX order
+/* what the exporter asks of a world, chunk by chunk. all the state lives in
+ * the object, and the export threads call it concurrently, so the methods
+ * are const and must not change anything shared. x and z are chunks from
+ * the world's corner, y sections from the bottom.
  */
-typedef void (*SectionCallback)(int x, int y, int z,
-        uint8_t *blocks, uint8_t *data, uint8_t *blocklight, uint8_t *skylight);
+struct Generator
+{
+    virtual ~Generator() { }
+
+    /* should fill heightmap with 16x16 ints in ZX order and
+     * biomes with 16x16 bytes in XZ order, and return the highest Y of any
+     * non-air block in the chunk (-1 if none). sections above it aren't
+     * exported and section() isn't called for them.
+     */
+    virtual int chunk(int x, int z, uint8_t *biomes, int32_t *heightmap) const = 0;
+
+    /* should fill blocks with 16x16x16 bytes in YZX order and
+     * data, blocklight, skylight with 16x16x16 half-bytes in YZX order
+     */
+    virtual void section(int x, int y, int z, uint8_t *blocks, uint8_t *data,
+            uint8_t *blocklight, uint8_t *skylight) const = 0;
+
+    // whether fingerprint() is implemented. without it every chunk is
+    // compressed and, with 'update', every region rewritten.
+    virtual bool hasFingerprints() const { return false; }
+
+    /* should fill key with FINGERPRINT_SIZE ints that determine everything
+     * chunk() and section() produce for the chunk: chunks with equal keys
+     * must come out the same, apart from their position. such chunks are
+     * compressed only once, and regions whose chunks' keys haven't changed
+     * since the last export can be left alone. 16x16 column heights and the
+     * sea level, say, if nothing else varies.
+     */
+    virtual void fingerprint(int x, int z, int32_t *key) const { }
+
+    /* may return a nonzero key for a section that's the same in many chunks,
+     * all stone or all air, say. sections with the same key and Y must come
+     * out the same from section(). they're generated and compressed once and
+     * reused. 0 for sections that have to be generated every time.
+     */
+    virtual uint32_t sectionKey(int x, int y, int z) const { return 0; }
+};
 
 
-/* XZY ordered byte array, assume height is 256
+/* how chunks are compressed. all methods produce zlib streams, which is
+ * what the game reads, they differ in speed and size.
  */
-struct BlockArray
+enum CompressionMethod
 {
-    unsigned char *buf;
-    const int xSize;
-    const int zSize;
-    const int ySize;
-
-    BlockArray(int _xSize, int _zSize) :
-        buf(0), xSize(_xSize), zSize(_zSize), ySize(256)
-    {
-        buf = new unsigned char[xSize * zSize * ySize];
-    }
-
-    ~BlockArray()
-    {
-        if (buf)
-            delete[] buf;
-    }
-
-    // unchecked!
-    inline unsigned char operator()(const int x, const int y, const int z) const
-    {
-        return buf[x * zSize * ySize + z * ySize + y];
-    }
-
-    // unchecked!
-    inline void set(const int x, const int y, const int z, const int id)
-    {
-        buf[x * zSize * ySize + z * ySize + y] = id;
-    }
+    ZLIB,        // zlib at 'level' (1 fastest .. 9 smallest)
+    ZLIB_RLE,    // zlib at 'level', matches only against the previous byte
+    FAST_DEFLATE // fastdeflate.h, for quick previews. ignores 'level'
 };
 
-/* ZX ordered height map of floats
- */
-struct Heightmap
+struct CompressionOptions
 {
-    float *buf;
-    const int size;
-
-    Heightmap(int _size) :
-        buf(0), size(_size)
-    {
-        buf = new float[size * size];
-    }
-
-    ~Heightmap()
-    {
-        if (buf)
-            delete[] buf;
-    }
-
-    // unchecked!
-    inline float get(const int x, const int z) const
-    {
-        return buf[z * size + x];
-    }
-
-    // unchecked!
-    inline void set(const int x, const int z, const float val)
-    {
-        buf[z * size + x] = val;
-    }
+    CompressionMethod method;
+    int level;
+
+    CompressionOptions(CompressionMethod _method = ZLIB, int _level = 6) :
+        method(_method), level(_level)
+    { }
 };
 
 
 ERR canExport(const char *worldName);
-ERR exportWorld(const char *worldName, int size, ChunkCallback chunkCB, SectionCallback sectionCB);
+/* with 'update', an existing world is updated in place: only regions whose
+ * fingerprints differ from those in the world's manifest are rewritten.
+ */
+ERR exportWorld(const char *worldName, int size, const Generator &generator,
+        const CompressionOptions &compression = CompressionOptions(),
+        bool update = false);
+
+/* compresses chunks of a world of the given size with each method at a few
+ * levels and prints speed and compression ratio. nothing is written.
+ */
+void benchmarkCompression(int size, const Generator &generator);
 
 #endif
 
@@ -0,0 +1,215 @@
+#include "fastdeflate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <zlib.h> // adler32
+using namespace std;
+
+const size_t WINDOW_SIZE = 32768;
+const size_t MIN_MATCH = 4; // shortest match looked for, deflate allows 3
+const size_t MAX_MATCH = 258;
+const size_t MAX_STORED = 65535; // bytes in a stored block
+const int MIN_HASH_BITS = 10;
+const int MAX_HASH_BITS = 15;
+
+
+inline uint32_t load32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+inline uint64_t load64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+inline uint32_t reverseBits(uint32_t code, int n) {
+    uint32_t r = 0;
+    for (int i = 0; i < n; i++, code >>= 1)
+        r = (r << 1) | (code & 1);
+    return r;
+}
+
+
+// fixed huffman codes of deflate (RFC 1951, 3.2.6), bit reversed so that
+// they can be written least significant bit first like everything else
+struct FixedCodes
+{
+    uint16_t lit[288];
+    uint8_t litLen[288];
+    uint8_t dist[30];
+
+    FixedCodes()
+    {
+        for (int s = 0; s < 288; s++) {
+            if (s < 144)      { litLen[s] = 8; lit[s] = reverseBits(0x30 + s, 8); }
+            else if (s < 256) { litLen[s] = 9; lit[s] = reverseBits(0x190 + s - 144, 9); }
+            else if (s < 280) { litLen[s] = 7; lit[s] = reverseBits(s - 256, 7); }
+            else              { litLen[s] = 8; lit[s] = reverseBits(0xC0 + s - 280, 8); }
+        }
+        for (int d = 0; d < 30; d++)
+            dist[d] = reverseBits(d, 5);
+    }
+};
+
+static const FixedCodes codes;
+
+
+// least significant bit first, as deflate wants it
+struct BitWriter
+{
+    uint8_t *out;
+    uint64_t bits;
+    int count;
+
+    BitWriter(uint8_t *_out) : out(_out), bits(0), count(0) { }
+
+    // at most 32 bits at a time
+    inline void put(uint32_t value, int n)
+    {
+        bits |= (uint64_t)value << count;
+        count += n;
+        if (count >= 32) {
+            out[0] = bits; out[1] = bits >> 8; out[2] = bits >> 16; out[3] = bits >> 24;
+            out += 4;
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+
+    inline void literal(uint8_t c) { put(codes.lit[c], codes.litLen[c]); }
+
+    void match(uint32_t length, uint32_t distance)
+    {
+        // length symbols 265.. have (n - 2) extra bits for lengths up to
+        // 2^n + 2, four symbols per n. 258 has its own symbol.
+        uint32_t x = length - 3;
+        if (length == MAX_MATCH) {
+            put(codes.lit[285], codes.litLen[285]);
+        } else if (x < 8) {
+            put(codes.lit[257 + x], codes.litLen[257 + x]);
+        } else {
+            int n = 31 - __builtin_clz(x);
+            int sym = 257 + 4 * (n - 1) + ((x >> (n - 2)) & 3);
+            put(codes.lit[sym], codes.litLen[sym]);
+            put(x & ((1u << (n - 2)) - 1), n - 2);
+        }
+
+        // same for distances, two codes per n with (n - 1) extra bits
+        uint32_t y = distance - 1;
+        if (y < 4) {
+            put(codes.dist[y], 5);
+        } else {
+            int n = 31 - __builtin_clz(y);
+            put(codes.dist[2 * n + ((y >> (n - 1)) & 1)], 5);
+            put(y & ((1u << (n - 1)) - 1), n - 1);
+        }
+    }
+
+    // flush, padding the last byte with zero bits
+    uint8_t *finish()
+    {
+        for (; count > 0; count -= 8, bits >>= 8)
+            *out++ = bits;
+        count = 0;
+        return out;
+    }
+};
+
+
+inline uint8_t *writeAdler(uint8_t *out, const uint8_t *in, size_t len)
+{
+    uint32_t a = adler32(adler32(0, NULL, 0), in, len);
+    out[0] = a >> 24; out[1] = a >> 16; out[2] = a >> 8; out[3] = a;
+    return out + 4;
+}
+
+static size_t storedSize(size_t len)
+{
+    return len + 5 * max((size_t)1, (len + MAX_STORED - 1) / MAX_STORED);
+}
+
+// input as is in stored blocks, for data that doesn't compress
+static size_t storeRaw(const uint8_t *in, size_t len, uint8_t *out, bool last)
+{
+    uint8_t *o = out;
+    size_t pos = 0;
+    do {
+        size_t n = min(len - pos, MAX_STORED);
+        *o++ = last && pos + n == len; // BFINAL, BTYPE 00
+        o[0] = n; o[1] = n >> 8; o[2] = ~n; o[3] = ~n >> 8;
+        memcpy(o + 4, in + pos, n);
+        o += 4 + n;
+        pos += n;
+    } while (pos < len);
+    return o - out;
+}
+
+size_t fast_deflate_bound(size_t len)
+{
+    // 9 bits per literal at worst, plus zlib header, block header, end code
+    // and adler
+    return 2 + max(storedSize(len), len + len / 8 + 2 + 8) + 4;
+}
+
+size_t fast_deflate_raw(const uint8_t *in, size_t len, uint8_t *out, bool last)
+{
+    // table of last position for each hash, sized by input
+    int bits = MIN_HASH_BITS;
+    while (bits < MAX_HASH_BITS && ((size_t)1 << bits) < len)
+        bits++;
+    static thread_local vector<uint32_t> table;
+    table.assign((size_t)1 << bits, 0);
+
+    BitWriter w(out);
+    w.put(last, 1); // BFINAL
+    w.put(1, 2); // fixed huffman codes
+
+    const uint8_t *p = in;
+    const uint8_t *end = in + len;
+    while (end - p >= (ptrdiff_t)MIN_MATCH) {
+        const uint32_t v = load32(p);
+        uint32_t &slot = table[(v * 2654435761u) >> (32 - bits)];
+        const uint8_t *cand = in + slot;
+        slot = p - in;
+
+        // candidate is before us, within the window, and really matches
+        if ((size_t)(p - cand - 1) >= WINDOW_SIZE || load32(cand) != v) {
+            w.literal(*p++);
+            continue;
+        }
+
+        const size_t limit = min(MAX_MATCH, (size_t)(end - p));
+        size_t n = MIN_MATCH;
+        while (n + 8 <= limit) {
+            uint64_t diff = load64(p + n) ^ load64(cand + n);
+            if (diff) {
+                n += __builtin_ctzll(diff) / 8;
+                goto matched;
+            }
+            n += 8;
+        }
+        while (n < limit && p[n] == cand[n])
+            n++;
+    matched:
+        w.match(n, p - cand);
+        p += n;
+    }
+    while (p < end)
+        w.literal(*p++);
+
+    w.put(codes.lit[256], codes.litLen[256]); // end of block
+    if (!last)
+        w.put(0, 3); // empty stored block to get to a byte boundary
+    uint8_t *o = w.finish();
+    if (!last) {
+        o[0] = 0x00; o[1] = 0x00; o[2] = 0xFF; o[3] = 0xFF;
+        o += 4;
+    }
+    const size_t n = o - out;
+
+    if (n > storedSize(len))
+        return storeRaw(in, len, out, last);
+    return n;
+}
+
+size_t fast_deflate_zlib(const uint8_t *in, size_t len, uint8_t *out)
+{
+    out[0] = 0x78; out[1] = 0x01; // deflate, 32K window, fastest level
+    const size_t n = fast_deflate_raw(in, len, out + 2);
+    return writeAdler(out + 2 + n, in, len) - out;
+}
@@ -0,0 +1,29 @@
+#ifndef H_FASTDEFLATE
+#define H_FASTDEFLATE
+
+#include <cstddef>
+#include <cstdint>
+
+/* whole-buffer deflate compressor producing zlib streams.
+ *
+ * trades compression ratio for speed: a single greedy pass with one hash
+ * table lookup per position and the fixed huffman codes of deflate, so
+ * there are no block statistics to gather and no trees to build. chunk data
+ * is long runs of a few values, which this handles well. the output can be
+ * read by any inflater, zlib's uncompress() included.
+ */
+
+// largest possible output for 'len' bytes of input
+size_t fast_deflate_bound(size_t len);
+
+// compress 'len' bytes into 'out', which must have room for
+// fast_deflate_bound(len) bytes. returns the size of the zlib stream.
+size_t fast_deflate_zlib(const uint8_t *in, size_t len, uint8_t *out);
+
+// same without zlib's header and checksum: a bare deflate stream. unless
+// 'last', it doesn't end in a final block but on a byte boundary, like
+// zlib's Z_SYNC_FLUSH, so that more deflate data can follow.
+size_t fast_deflate_raw(const uint8_t *in, size_t len, uint8_t *out,
+        bool last = true);
+
+#endif
@@ -1,47 +1,55 @@
 #include "generate.h"
 
 #include "lithosphere.hpp" // platec
+#include "blockarray.h"
 #include "export.h"
+#include "heightmap.h"
+#include "parallel.h"
 #include "MersenneTwister.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
-inline int max(int a, int b) { return a < b ? b : a; }
-
-// fill with zeroes
-inline void clear(BlockArray& b) { 
-    std::fill_n(b.buf, b.xSize * b.zSize * b.ySize, 0);
-}
 
-inline void clear(Heightmap *h) { 
-    std::fill_n(h->buf, h->size * h->size, 0.0f);
-}
+inline int max(int a, int b) { return a < b ? b : a; }
 
 // unchecked!
 inline void makeBox(BlockArray& b,
         int x, int y, int z, int sx, int sy, int sz, int id) {
-    for (int ix = x; ix < x + sx; ix++)
-    for (int iz = z; iz < z + sz; iz++)
-    for (int iy = y; iy < y + sy; iy++)
-        b.set(ix,iy,iz, id);
+    b.fill(x, y, z, sx, sy, sz, id);
 }
 
-// unchecked!
+// copies that land outside 'b' are cut off
 inline void duplicateBox(BlockArray& b,
         int x, int y, int z, int sx, int sy, int sz,
         int dx, int dy, int dz, int iterations) {
     for (int i = 1; i <= iterations; i++)
     for (int ix = x; ix < x + sx; ix++)
     for (int iz = z; iz < z + sz; iz++)
-    for (int iy = y; iy < y + sy; iy++)
-        if(b(ix,iy,iz))
-            b.set(ix+dx*i, iy+dy*i, iz+dz*i, b(ix,iy,iz));
+    for (int iy = y; iy < y + sy; iy++) {
+        const int tx = ix+dx*i, ty = iy+dy*i, tz = iz+dz*i;
+        if (b(ix,iy,iz) && tx >= 0 && tx < b.xSize && ty >= 0 &&
+                ty < b.ySize && tz >= 0 && tz < b.zSize)
+            b.set(tx, ty, tz, b(ix,iy,iz));
+    }
 }
 
 
 
-BlockArray gen1(const int size, const int voidPadding)
+// returns new block array (delete it yourself)
+BlockArray *gen1(const int size, const int voidPadding, const unsigned int seed)
 {
     const int fullSize = size + voidPadding * 2; // inner padding
     const int mx = fullSize * 16;
@@ -49,17 +57,13 @@ BlockArray gen1(const int size, const int voidPadding)
     const int my = 256;
     const int pd = voidPadding * 16; // padding in blocks
 
-    BlockArray b(mx, mz); // our world representation
-    clear(b);
+    BlockArray *out = new BlockArray(mx, mz); // our world representation, all air
+    BlockArray &b = *out;
 
-    MTRand rng; // random number generator
+    MTRand rng(seed); // random number generator
 
     // make some stone
-    for (int x = pd; x < mx - pd; x++)
-    for (int z = pd; z < mz - pd; z++)
-    for (int y = 0; y < my; y++) {
-        b.set(x,y,z, y < 128 ? 1 : 0);
-    }
+    makeBox(b, pd, 0, pd, mx - pd*2, my / 2, mz - pd*2, 1);
 
     // make random boxes near ground level
     //const int BOXES_PER_CHUNK = 64;
@@ -85,7 +89,6 @@ BlockArray gen1(const int size, const int voidPadding)
     */
 
     // copypaste boxes
-    // XXX: likely to generate outside bounds!
     for (int i = 0; i < size*size*DUPES_PER_CHUNK; i++) {
         int sizex = rng.randInt(MAX_DUP_SIZE - 1) + 1;
         int sizey = rng.randInt(MAX_DUP_SIZE - 1) + 1;
@@ -101,7 +104,8 @@ BlockArray gen1(const int size, const int voidPadding)
                 rng.randInt(MAX_DUP_ITERATIONS - 3) + 3);
     }
 
-    return b;
+    b.compact();
+    return out;
 }
 
 
@@ -126,16 +130,21 @@ BlockArray gen1(const int size, const int voidPadding)
 #define DEFAULT_FOLDING_RATIO		0.001f
 #define DEFAULT_SEA_LEVEL		0.65f
 
-// returns new heightmap (delete it yourself)
+// returns new 'map_width' x 'map_height' heightmap, rows of 'map_width'
+// (delete it yourself). sides out of range are clamped, and set to the
+// ones the heightmap has
 float *runPlatec(
     size_t num_plates,
-    size_t map_side,
+    size_t &map_width,
+    size_t &map_height,
     size_t aggr_overlap_abs,
     float aggr_overlap_rel,
     size_t cycle_count,
     size_t erosion_period,
     float folding_ratio,
-    float sea_level)
+    float sea_level,
+    bool voronoi,
+    unsigned int seed)
 {
     lithosphere* world;
 
@@ -153,13 +162,10 @@ float *runPlatec(
         _DEST = val; \
 	} while (0)
 
-	CHECK_RANGE(map_side, size_t, "%u", 'l', MIN_MAP_SIDE,
+	CHECK_RANGE(map_width, size_t, "%u", 'w', MIN_MAP_SIDE,
+		MAX_MAP_SIDE, DEFAULT_MAP_SIDE);
+	CHECK_RANGE(map_height, size_t, "%u", 'h', MIN_MAP_SIDE,
 		MAX_MAP_SIDE, DEFAULT_MAP_SIDE);
-
-	if (map_side & (map_side - 1))
-		printf("Length of map's side must be a power "
-		       "of two! Using default value %d.\n",
-		       map_side = DEFAULT_MAP_SIDE);
 
 	CHECK_RANGE(num_plates, size_t, "%u", 'n', MIN_PLATES,
 		MAX_PLATES, DEFAULT_NUM_PLATES);
@@ -177,16 +183,19 @@ float *runPlatec(
 	CHECK_RANGE(sea_level, float, "%f", 's', 0.0f,
 		CONTINENTAL_BASE, DEFAULT_SEA_LEVEL);
 
-	printf("map:\t\t%u\nsea:\t\t%f\nplates:\t\t%u\nerosion period:\t%u\n"
+	printf("map:\t\t%ux%u\nsea:\t\t%f\nplates:\t\t%u\nerosion period:\t%u\n"
 	       "folding:\t%f\noverlap abs:\t%u\noverlap rel:\t%f\n"
-	       "cycles:\t\t%u\n", map_side, sea_level, num_plates,
-	       erosion_period, folding_ratio, aggr_overlap_abs,
-	       aggr_overlap_rel, cycle_count);
-
-	srand(time(0));
-
-	world = new lithosphere(map_side, sea_level, erosion_period,
-		folding_ratio, aggr_overlap_abs, aggr_overlap_rel, cycle_count);
+	       "cycles:\t\t%u\nthreads:\t%d\nseed:\t\t%u\n", (unsigned)map_width,
+	       (unsigned)map_height, sea_level, (unsigned)num_plates,
+	       (unsigned)erosion_period, folding_ratio,
+	       (unsigned)aggr_overlap_abs, aggr_overlap_rel,
+	       (unsigned)cycle_count, parallel_get_threads(), seed);
+
+	world = new lithosphere(map_width, map_height, sea_level,
+		erosion_period, folding_ratio, aggr_overlap_abs,
+		aggr_overlap_rel, cycle_count, seed);
+	if (voronoi)
+		world->setPartitionMethod(lithosphere::NOISY_VORONOI);
 	world->createPlates(num_plates);
 
     // main loop
@@ -194,21 +203,178 @@ float *runPlatec(
         world->update();
     }
 
+    const std::vector<double>& erosion = world->getErosionTimes();
+    for (size_t i = 0; i < erosion.size(); ++i)
+        printf("erosion %u:\t%.1f ms\n", (unsigned)i, erosion[i] * 1e3);
+    printf("plate growths:\t%u\n", (unsigned)world->getExtensionCount());
+
     const float *hmap = world->getTopography();
-    float *hmapCopy = new float[map_side*map_side];
-    std::copy_n(hmap, map_side*map_side, hmapCopy);
+    float *hmapCopy = new float[map_width*map_height];
+    std::copy_n(hmap, map_width*map_height, hmapCopy);
 
 	delete world;
 	return hmapCopy;
 }
 
 
-// globals for callbacks
-Heightmap *worldmap = NULL;
-float sealevel = 0;
+// most memory the process has held at once, in bytes
+static size_t peakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return (size_t)usage.ru_maxrss * 1024; // kB on linux
+    return 0;
+#endif
+}
+
+/* times the steps of platec on a 'side' x 'side' map and reports the
+ * process's peak memory. the first step is left out, it's mostly
+ * allocation. run one size per process, peak memory only ever grows.
+ */
+void benchmarkPlatec(size_t side, bool voronoi, unsigned int seed)
+{
+    const size_t STEPS = 20;
+
+    lithosphere world(side, side, DEFAULT_SEA_LEVEL, DEFAULT_EROSION_PERIOD,
+            DEFAULT_FOLDING_RATIO, DEFAULT_AGGR_OVERLAP_ABS,
+            DEFAULT_AGGR_OVERLAP_REL, DEFAULT_CYCLE_COUNT, seed);
+    if (voronoi)
+        world.setPartitionMethod(lithosphere::NOISY_VORONOI);
+    world.createPlates(DEFAULT_NUM_PLATES);
+    world.update();
+
+    size_t steps = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (; steps < STEPS && world.getPlateCount(); steps++)
+        world.update();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("map:\t\t%ux%u\nthreads:\t%d\nseed:\t\t%u\n",
+           (unsigned)side, (unsigned)side, parallel_get_threads(), seed);
+    printf("step:\t\t%.1f ms (%u steps)\npeak memory:\t%u MiB\n",
+           steps ? elapsed.count() * 1e3 / steps : 0.0, (unsigned)steps,
+           (unsigned)(peakMemory() >> 20));
+}
+
+// weights of the four samples around a point 't' (0..1) of the way from
+// the second to the third
+static void interpolationWeights(Interpolation method, float t, float *w)
+{
+    if (method == BICUBIC) {
+        // catmull-rom: goes through the samples, with smooth slopes
+        const float t2 = t * t, t3 = t2 * t;
+        w[0] = 0.5f * (-t3 + 2.0f*t2 - t);
+        w[1] = 0.5f * (3.0f*t3 - 5.0f*t2 + 2.0f);
+        w[2] = 0.5f * (-3.0f*t3 + 4.0f*t2 + t);
+        w[3] = 0.5f * (t3 - t2);
+    } else {
+        w[0] = 0.0f;
+        w[1] = 1.0f - t;
+        w[2] = t;
+        w[3] = 0.0f;
+    }
+}
+
+/* scales platec's 'side' x 'side' heightmap up 'scale' times, a part at a
+ * time, and multiplies heights by 'scalev'. platec's maps wrap around, so
+ * do samples past the edges.
+ *
+ * the heightmap is in XZ order and the output in ZX order, so it's
+ * transposed up front. every row of output is then written front to back,
+ * from one row of samples interpolated between the rows around it.
+ */
+struct Upsampler : TileSource
+{
+    const int side, scale;
+    const float scalev;
+    const Interpolation method;
+    std::vector<float> t; // the heightmap, ZX order
+    std::vector<float> weights; // for each of the 'scale' blocks from one
+                                // sample to the next
+
+    Upsampler(const float *hm, int _side, int _scale, float _scalev,
+            Interpolation _method) :
+        side(_side), scale(_scale), scalev(_scalev), method(_method),
+        t(_side * _side), weights(_scale * 4)
+    {
+        const int TILE = 32;
+
+        // a tile at a time so that both sides stay in cache
+        float *tp = &t[0];
+        const int tiles = (_side + TILE - 1) / TILE;
+        parallel_for(tiles, [=](int tz) {
+            const int z0 = tz * TILE, z1 = std::min(z0 + TILE, _side);
+            for (int x0 = 0; x0 < _side; x0 += TILE) {
+                const int x1 = std::min(x0 + TILE, _side);
+                for (int z = z0; z < z1; z++)
+                for (int x = x0; x < x1; x++)
+                    tp[z * _side + x] = hm[x * _side + z];
+            }
+        });
+
+        for (int k = 0; k < scale; k++)
+            interpolationWeights(method, (float)k/(float)scale, &weights[k * 4]);
+    }
+
+    int wrap(int i) const { return ((i % side) + side) % side; }
+
+    void fill(int x, int z, int w, int h, float *out, int stride) const
+    {
+        // samples from the one before the first block to two after the
+        // last, for the weights
+        const int first = x / scale - 1;
+        const int samples = (x + w - 1) / scale + 3 - first;
+        std::vector<float> line(samples);
+
+        for (int iz = z; iz < z + h; iz++) {
+            // between rows of the heightmap
+            const int sz = iz / scale;
+            float wz[4];
+            interpolationWeights(method, (float)(iz - sz*scale)/(float)scale, wz);
+            const float *r[4];
+            for (int j = 0; j < 4; j++)
+                r[j] = &t[wrap(sz - 1 + j) * side];
+
+            // a stretch up to the heightmap's edge at a time
+            for (int i = 0, ix = wrap(first); i < samples; ix = 0) {
+                const int n = std::min(samples - i, side - ix);
+                float *l = &line[i];
+                #pragma omp simd
+                for (int j = 0; j < n; j++)
+                    l[j] = r[0][ix+j]*wz[0] + r[1][ix+j]*wz[1] + r[2][ix+j]*wz[2] + r[3][ix+j]*wz[3];
+                i += n;
+            }
+
+            // and along the row, every 'scale'th block at a time so that the
+            // weights stay the same
+            float *row = out + (iz - z) * stride;
+            for (int k = 0; k < scale; k++) {
+                const float *wx = &weights[k * 4];
+                const int x0 = x + ((k - x % scale) + scale) % scale; // first with k
+                if (x0 >= x + w)
+                    continue;
+                const int n = (x + w - x0 + scale - 1) / scale;
+                const float *l = &line[x0 / scale - 1 - first];
+                float *o = row + x0 - x;
+                #pragma omp simd
+                for (int j = 0; j < n; j++)
+                    o[j * scale] = (l[j]*wx[0] + l[j+1]*wx[1] + l[j+2]*wx[2] + l[j+3]*wx[3]) * scalev;
+            }
+        }
+    }
+};
+
 
 void genPlatec(const int size, const int voidPadding,
-        const int scaleh, const int scalev, Heightmap **out_worldmap, float *out_sealevel)
+        int scaleh, const int scalev, const bool voronoi,
+        const unsigned int seed, const Interpolation interpolation,
+        Heightmap **out_worldmap, float *out_sealevel)
 {
     const int fullSize = size + voidPadding * 2; // inner padding
     const int mx = fullSize * 16;
@@ -218,40 +384,39 @@ void genPlatec(const int size, const int voidPadding,
 
     //const float yscale = 256.0f/(float)scalev;
 
-    const int map_side = (mz - pd*2) / scaleh;
+    // platec's memory grows with its map's area, so past the largest map
+    // that scale would need, each of its pixels stands for more blocks
+    const int blocks = mz - pd*2;
+    if (blocks / scaleh > MAX_MAP_SIDE) {
+        scaleh = (blocks + MAX_MAP_SIDE - 1) / MAX_MAP_SIDE;
+        printf("platec map too large: setting horizontal scale to %d.\n", scaleh);
+    }
+
+    size_t map_width = blocks / scaleh;
+    size_t map_height = map_width;
     const float sea_level = DEFAULT_SEA_LEVEL;
 
     // get heightmap from platec (be sure to delete it)
     float *hm = runPlatec(
             DEFAULT_NUM_PLATES,
-            map_side,
+            map_width,
+            map_height,
             DEFAULT_AGGR_OVERLAP_ABS,
             DEFAULT_AGGR_OVERLAP_REL,
             DEFAULT_CYCLE_COUNT,
             DEFAULT_EROSION_PERIOD,
             DEFAULT_FOLDING_RATIO,
-            sea_level);
+            sea_level,
+            voronoi,
+            seed);
 
 
-    Heightmap *out = new Heightmap(mz); // our world representation
-    clear(out);
+    // our world representation, interpolated from the heightmap as it's read
+    Heightmap *out = new Heightmap(mz, pd, mx - pd*2,
+            new Upsampler(hm, map_width, scaleh, scalev, interpolation));
 
     //MTRand rng; // random number generator
 
-    // interpolate heightmap
-    for (int x = 0; x < mx - pd*2; x++)
-    for (int z = 0; z < mz - pd*2; z++) {
-        int ix = x/scaleh;
-        int iz = z/scaleh;
-        float fx = (float)(x - ix*scaleh)/(float)scaleh;
-        float fz = (float)(z - iz*scaleh)/(float)scaleh;
-        float x0 = hm[(ix)*map_side + (iz)] * (1.0f-fz)
-                 + hm[(ix)*map_side + (iz+1)] * fz;
-        float x1 = hm[(ix+1)*map_side + (iz)] * (1.0f-fz)
-                 + hm[(ix+1)*map_side + (iz+1)] * fz;
-        out->set(x+pd, z+pd, (x0*(1.0f-fx) + x1*fx) * scalev);
-    }
-
     *out_worldmap = out;
     *out_sealevel = sea_level * scalev;
 
@@ -259,71 +424,332 @@ void genPlatec(const int size, const int voidPadding,
 }
 
 
-void chunkCB(int x, int z, uint8_t *biomes, int32_t *heightmap)
+/* heights of the columns of the chunk whose sections this thread filled
+ * last. sections of a chunk are filled one after another by one thread,
+ * so every column is looked up once per chunk rather than once per block.
+ */
+struct ColumnCache
 {
-    x *= 16;
-    z *= 16;
+    unsigned owner; // id of the generator
+    int x, z; // blocks
+    // ZX order, clamped to -1..CHUNK_HEIGHT-1 so they fit in 16 bits, which
+    // doesn't change how they compare to any Y in the chunk
+    int16_t height[CHUNK_WIDTH * CHUNK_WIDTH];
+    int low, high; // lowest and highest of them
+
+    // heights from 'map'
+    void load(unsigned _owner, const Heightmap *map, int _x, int _z)
+    {
+        if (owner == _owner && x == _x && z == _z)
+            return;
+
+        owner = _owner;
+        x = _x;
+        z = _z;
+        float heights[CHUNK_WIDTH * CHUNK_WIDTH];
+        map->read(x, z, CHUNK_WIDTH, CHUNK_WIDTH, heights);
+        for (int i = 0; i < CHUNK_WIDTH * CHUNK_WIDTH; i++)
+            height[i] = std::min(max((int)heights[i], -1), CHUNK_HEIGHT - 1);
+        findLimits();
+    }
 
-    // XZ order
-    for (int i = 0; i < BIOMES_SIZE; i++)
-        biomes[i] = 0;
+    // the highest block that isn't air in each column of 'blocks'
+    void load(unsigned _owner, const BlockArray *blocks, int _x, int _z)
+    {
+        if (owner == _owner && x == _x && z == _z)
+            return;
+
+        owner = _owner;
+        x = _x;
+        z = _z;
+        std::fill_n(height, CHUNK_WIDTH * CHUNK_WIDTH, -1);
+
+        // from the top down, past sections of air without looking at their
+        // blocks, until a section of anything else stops all columns left
+        int left = CHUNK_WIDTH * CHUNK_WIDTH; // without a height yet
+        for (int sy = MAX_SECTIONS - 1; sy >= 0 && left; sy--) {
+            const int y = sy * SECTION_HEIGHT;
+            uint8_t id;
+            if (blocks->uniform(x / CHUNK_WIDTH, sy, z / CHUNK_WIDTH, &id)) {
+                if (!id)
+                    continue;
+                for (auto &h : height)
+                    if (h < 0)
+                        h = y + SECTION_HEIGHT - 1;
+                break;
+            }
+
+            for (int i = 0; i < CHUNK_WIDTH * CHUNK_WIDTH; i++) {
+                if (height[i] >= 0)
+                    continue;
+                for (int iy = y + SECTION_HEIGHT - 1; iy >= y; iy--) {
+                    if ((*blocks)(x + i % CHUNK_WIDTH, iy, z + i / CHUNK_WIDTH)) {
+                        height[i] = iy;
+                        left--;
+                        break;
+                    }
+                }
+            }
+        }
+        findLimits();
+    }
 
-    // ZX order
-    for (int iz = 0; iz < CHUNK_WIDTH; iz++)
-    for (int ix = 0; ix < CHUNK_WIDTH; ix++)
-        heightmap[iz * CHUNK_WIDTH + ix] = (int)worldmap->get(x+ix, z+iz);
-}
+    void findLimits()
+    {
+        low = CHUNK_HEIGHT - 1;
+        high = -1;
+        for (int i = 0; i < CHUNK_WIDTH * CHUNK_WIDTH; i++) {
+            low = std::min(low, (int)height[i]);
+            high = max(high, (int)height[i]);
+        }
+    }
+};
+
+// of whichever generator the thread worked for last
+static thread_local ColumnCache columns = { 0, 0, 0, {}, 0, 0 };
 
-void sectionCB(int x, int y, int z,
-        uint8_t *blocks, uint8_t *data, uint8_t *blocklight, uint8_t *skylight)
+// generators made so far, to tell them apart in the cache
+static std::atomic<unsigned> generators(0);
+
+enum sectionKey { SURFACE_SECTION, SOLID_SECTION, OPEN_SECTION };
+
+/* stone up to the heights of 'worldmap', water above it up to the sea
+ * level and air above that. nothing is written after construction, so
+ * export threads may share one.
+ */
+struct PlatecGenerator : Generator
 {
-    x *= 16;
-    y *= 16;
-    z *= 16;
-
-    const int sea = (int)sealevel;
-    int i = 0;
-    // YZX order
-    for (int iy = y; iy < y + SECTION_HEIGHT; iy++)
-    for (int iz = z; iz < z + CHUNK_WIDTH; iz++)
-    for (int ix = x; ix < x + CHUNK_WIDTH; ix++) {
-        int val = (int)worldmap->get(ix, iz);
-
-        blocks[i] = iy <= val ? 1 : (iy <= sea ? 9 : 0);
-
-        uint8_t sl = iy <= val ? 0 : (iy <= sea ? max(0, 12-3*(sea-iy)) : 15);
-        if (i & 1) {
-            skylight[i/2] |= sl << 4;
-        } else {
-            skylight[i/2] = sl;
-            data[i/2] = 0;
-            blocklight[i/2] = 0;
+    const Heightmap *worldmap; // owned
+    const float sealevel;
+    const unsigned id; // tells the generators' columns apart in the cache
+
+    PlatecGenerator(const Heightmap *_worldmap, float _sealevel) :
+        worldmap(_worldmap), sealevel(_sealevel), id(++generators)
+    { }
+
+    ~PlatecGenerator()
+    {
+        delete worldmap;
+    }
+
+    int chunk(int x, int z, uint8_t *biomes, int32_t *heightmap) const
+    {
+        x *= 16;
+        z *= 16;
+
+        // XZ order
+        for (int i = 0; i < BIOMES_SIZE; i++)
+            biomes[i] = 0;
+
+        // ZX order. section() fills everything up to the ground or the sea,
+        // whichever is higher.
+        int top = (int)sealevel;
+        float heights[HEIGHTMAP_SIZE];
+        worldmap->read(x, z, CHUNK_WIDTH, CHUNK_WIDTH, heights);
+        for (int i = 0; i < HEIGHTMAP_SIZE; i++) {
+            int val = (int)heights[i];
+            heightmap[i] = val;
+            top = max(top, val);
         }
+        return top;
+    }
 
-        ++i;
+    // chunk() and section() depend on nothing but column heights and sea level
+    bool hasFingerprints() const { return true; }
+
+    void fingerprint(int x, int z, int32_t *key) const
+    {
+        x *= 16;
+        z *= 16;
+
+        float heights[CHUNK_WIDTH * CHUNK_WIDTH];
+        worldmap->read(x, z, CHUNK_WIDTH, CHUNK_WIDTH, heights);
+        for (int i = 0; i < CHUNK_WIDTH * CHUNK_WIDTH; i++)
+            key[i] = (int)heights[i];
+        key[CHUNK_WIDTH * CHUNK_WIDTH] = (int)sealevel;
+    }
+
+    // sections below the lowest column are all stone, those above the highest
+    // all water or air. either only depends on Y and the sea level.
+    uint32_t sectionKey(int x, int y, int z) const
+    {
+        columns.load(id, worldmap, x * 16, z * 16);
+        y *= 16;
+
+        if (y + SECTION_HEIGHT - 1 <= columns.low)
+            return SOLID_SECTION;
+        if (y > columns.high)
+            return OPEN_SECTION;
+        return SURFACE_SECTION;
     }
-}
+
+    void section(int x, int y, int z, uint8_t *blocks, uint8_t *data,
+            uint8_t *blocklight, uint8_t *skylight) const
+    {
+        const int LAYER_SIZE = CHUNK_WIDTH * CHUNK_WIDTH;
+
+        columns.load(id, worldmap, x * 16, z * 16);
+        const int16_t *height = columns.height;
+        y *= 16;
+
+        const int sea = (int)sealevel;
+        // YZX order, a layer at a time. 16 bit Y so that comparisons with
+        // heights don't need wider vectors.
+        for (int16_t iy = y; iy < y + SECTION_HEIGHT; iy++) {
+            // above the ground there's either water, darker the deeper it is,
+            // or air
+            const uint8_t fill = iy <= sea ? 9 : 0;
+            const uint8_t light = iy <= sea ? max(0, 12-3*(sea-iy)) : 15;
+
+            uint8_t *b = blocks + (iy - y) * LAYER_SIZE;
+            // two blocks per byte, the first one in the low nibble
+            uint8_t *sl = skylight + (iy - y) * LAYER_SIZE / 2;
+
+            // layers below or above all columns are all the same
+            if (iy <= columns.low) {
+                memset(b, 1, LAYER_SIZE);
+                memset(sl, 0, LAYER_SIZE / 2);
+                continue;
+            }
+            if (iy > columns.high) {
+                memset(b, fill, LAYER_SIZE);
+                memset(sl, light | light << 4, LAYER_SIZE / 2);
+                continue;
+            }
+
+            #pragma omp simd
+            for (int i = 0; i < LAYER_SIZE; i++)
+                b[i] = iy <= height[i] ? 1 : fill;
+
+            // no light in the ground, where blocks just got 1
+            #pragma omp simd
+            for (int i = 0; i < LAYER_SIZE / 2; i++)
+                sl[i] = (b[2*i] == 1 ? 0 : light) | (b[2*i+1] == 1 ? 0 : light) << 4;
+        }
+
+        memset(data, 0, DATA_SIZE);
+        memset(blocklight, 0, BLOCKLIGHT_SIZE);
+    }
+};
+
+
+/* the blocks of a BlockArray as they are, lit from the sky down to the
+ * highest block of each column. nothing is written after construction, so
+ * export threads may share one.
+ */
+struct BlockArrayGenerator : Generator
+{
+    const BlockArray *blocks; // owned
+    const unsigned id; // tells the generators' columns apart in the cache
+
+    // key of sections of air below the highest block of every column, so
+    // without light. other sections of one block are keyed by its id.
+    static const uint32_t DARK_AIR_SECTION = 256;
+
+    BlockArrayGenerator(const BlockArray *_blocks) :
+        blocks(_blocks), id(++generators)
+    { }
+
+    ~BlockArrayGenerator()
+    {
+        delete blocks;
+    }
+
+    int chunk(int x, int z, uint8_t *biomes, int32_t *heightmap) const
+    {
+        columns.load(id, blocks, x * 16, z * 16);
+
+        // XZ order
+        for (int i = 0; i < BIOMES_SIZE; i++)
+            biomes[i] = 0;
+
+        // ZX order
+        for (int i = 0; i < HEIGHTMAP_SIZE; i++)
+            heightmap[i] = columns.height[i];
+        return columns.high;
+    }
+
+    // sections all of one block have no light, every column reaches their
+    // top. nor do sections of air below every column's highest block.
+    uint32_t sectionKey(int x, int y, int z) const
+    {
+        uint8_t block;
+        if (!blocks->uniform(x, y, z, &block))
+            return 0;
+        if (block)
+            return block;
+
+        columns.load(id, blocks, x * 16, z * 16);
+        if (y * 16 + SECTION_HEIGHT - 1 <= columns.low)
+            return DARK_AIR_SECTION;
+        return 0;
+    }
+
+    void section(int x, int y, int z, uint8_t *out, uint8_t *data,
+            uint8_t *blocklight, uint8_t *skylight) const
+    {
+        const int LAYER_SIZE = CHUNK_WIDTH * CHUNK_WIDTH;
+
+        columns.load(id, blocks, x * 16, z * 16);
+        const int16_t *height = columns.height;
+        blocks->section(x, y, z, out);
+        y *= 16;
+
+        // YZX order, a layer at a time. two blocks per byte, the first one
+        // in the low nibble.
+        for (int16_t iy = y; iy < y + SECTION_HEIGHT; iy++) {
+            uint8_t *sl = skylight + (iy - y) * LAYER_SIZE / 2;
+            #pragma omp simd
+            for (int i = 0; i < LAYER_SIZE / 2; i++)
+                sl[i] = (iy > height[2*i] ? 15 : 0) | (iy > height[2*i+1] ? 15 : 0) << 4;
+        }
+
+        memset(data, 0, DATA_SIZE);
+        memset(blocklight, 0, BLOCKLIGHT_SIZE);
+    }
+};
 
 
 /* generates a square world 'size' chunks to a side,
  * with width 'voidPadding' of empty chunks on all sides.
  * 'worldName' is both directory name and in-game name.
+ * with 'update', an existing world of that name is updated in place.
+ * with 'benchmark', chunk compression is measured instead of exporting.
  */
-ERR generateWorld(const char *worldName, const int size, const int voidPadding,
-        int pt_scaleh, int pt_scalev)
+ERR generateWorld(const char *worldName, GeneratorType type,
+        const int size, const int voidPadding,
+        int pt_scaleh, int pt_scalev, bool voronoi, unsigned int seed,
+        Interpolation interpolation, const CompressionOptions &compression,
+        bool update, bool benchmark)
 {
-    ERR result = canExport(worldName);
+    ERR result = benchmark || update ? ERR::NONE : canExport(worldName);
     if (result != ERR::NONE)
         return result;
 
     std::cout << "generating..." << std::endl;
 
     // generate
-    //BlockArray b = gen1(size, voidPadding);
-    genPlatec(size, voidPadding, pt_scaleh, pt_scalev, &worldmap, &sealevel);
+    std::unique_ptr<Generator> generator;
+    if (type == BOXES) {
+        BlockArray *b = gen1(size, voidPadding, seed);
+        std::cout << "blocks:\t\t" << b->bytes() / 1024 << " kB" << std::endl;
+        generator.reset(new BlockArrayGenerator(b));
+    } else {
+        Heightmap *worldmap;
+        float sealevel;
+        genPlatec(size, voidPadding, pt_scaleh, pt_scalev, voronoi, seed,
+                interpolation, &worldmap, &sealevel);
+        generator.reset(new PlatecGenerator(worldmap, sealevel));
+    }
+
+    if (benchmark) {
+        benchmarkCompression(size + voidPadding * 2, *generator);
+        return ERR::NONE;
+    }
 
     // export
-    result = exportWorld(worldName, size + voidPadding * 2, chunkCB, sectionCB);
+    result = exportWorld(worldName, size + voidPadding * 2, *generator,
+            compression, update);
 
     return result;
 }
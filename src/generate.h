@@ -2,9 +2,23 @@
 #define H_GENERATE
 
 #include "error.h"
+#include "export.h"
 
-ERR generateWorld(const char *worldName, int size, int voidPadding,
-        int pt_scaleh, int pt_scalev);
+// what makes the world: plate tectonics, or stone with boxes copied about
+// on top, block by block
+enum GeneratorType { PLATEC, BOXES };
+
+// how platec's heightmap is scaled up to blocks
+enum Interpolation { BILINEAR, BICUBIC };
+
+ERR generateWorld(const char *worldName, GeneratorType type,
+        int size, int voidPadding,
+        int pt_scaleh, int pt_scalev, bool voronoi, unsigned int seed,
+        Interpolation interpolation, const CompressionOptions &compression,
+        bool update = false, bool benchmark = false);
+
+// times platec steps on a 'side' x 'side' map and prints peak memory
+void benchmarkPlatec(size_t side, bool voronoi, unsigned int seed);
 
 #endif
 
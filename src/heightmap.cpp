@@ -0,0 +1,77 @@
+#include "heightmap.h"
+
+#include <algorithm>
+using namespace std;
+
+// std::min takes it by reference, so it needs a definition
+const int Heightmap::TILE;
+
+Heightmap::Heightmap(int _size, int _border, int _width, TileSource *_source,
+        size_t _maxTiles) :
+    size(_size),
+    border(_border),
+    width(_width),
+    source(_source),
+    maxTiles(max(_maxTiles, (size_t)1)),
+    tilesX((_width + TILE - 1) / TILE)
+{ }
+
+void Heightmap::read(int x, int z, int w, int h, float *out) const
+{
+    // the part inside the square, relative to it
+    const int x0 = max(x - border, 0), x1 = min(x + w - border, width);
+    const int z0 = max(z - border, 0), z1 = min(z + h - border, width);
+    const bool inside = x0 == x - border && x1 == x + w - border &&
+        z0 == z - border && z1 == z + h - border;
+    if (!inside)
+        fill_n(out, w * h, 0.0f);
+    if (x0 >= x1 || z0 >= z1)
+        return;
+
+    for (int tz = z0 / TILE; tz <= (z1 - 1) / TILE; tz++)
+    for (int tx = x0 / TILE; tx <= (x1 - 1) / TILE; tx++) {
+        const Tile t = tile(tx, tz);
+        const int cx0 = max(x0, tx * TILE), cx1 = min(x1, (tx + 1) * TILE);
+        const int cz0 = max(z0, tz * TILE), cz1 = min(z1, (tz + 1) * TILE);
+        for (int iz = cz0; iz < cz1; iz++)
+            copy_n(&(*t)[(iz - tz * TILE) * TILE + cx0 - tx * TILE], cx1 - cx0,
+                    out + (iz + border - z) * w + cx0 + border - x);
+    }
+}
+
+Heightmap::Tile Heightmap::tile(int tx, int tz) const
+{
+    const int key = tz * tilesX + tx;
+    {
+        lock_guard<mutex> lk(lock);
+        auto it = tiles.find(key);
+        if (it != tiles.end()) {
+            lru.splice(lru.begin(), lru, it->second.used);
+            return it->second.tile;
+        }
+    }
+
+    // computed without the lock, so that other tiles can be read meanwhile.
+    // threads that miss the same tile at once each compute it, the first
+    // one to finish is kept.
+    shared_ptr<vector<float> > t = make_shared<vector<float> >(TILE * TILE);
+    source->fill(tx * TILE, tz * TILE, min(TILE, width - tx * TILE),
+            min(TILE, width - tz * TILE), &(*t)[0], TILE);
+
+    lock_guard<mutex> lk(lock);
+    auto it = tiles.find(key);
+    if (it != tiles.end()) {
+        lru.splice(lru.begin(), lru, it->second.used);
+        return it->second.tile;
+    }
+
+    lru.push_front(key);
+    Entry e = { t, lru.begin() };
+    tiles.emplace(key, e);
+    // tiles still being copied from stay alive until their readers are done
+    while (tiles.size() > maxTiles) {
+        tiles.erase(lru.back());
+        lru.pop_back();
+    }
+    return t;
+}
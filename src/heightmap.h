@@ -0,0 +1,70 @@
+#ifndef H_HEIGHTMAP
+#define H_HEIGHTMAP
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+/* computes the heights of part of a Heightmap's inner square on demand
+ */
+struct TileSource
+{
+    virtual ~TileSource() { }
+
+    // should fill 'out' with the 'w' x 'h' heights from 'x', 'z' of the
+    // square, in ZX order with rows 'stride' apart. called from several
+    // threads at once.
+    virtual void fill(int x, int z, int w, int h, float *out, int stride) const = 0;
+};
+
+
+/* ZX ordered height map of floats, 'size' to a side. heights come from a
+ * TileSource in a square 'width' to a side, 'border' from the corner, and
+ * are zero in the border around it.
+ *
+ * the square is split into TILE x TILE tiles that are computed the first
+ * time they're read. only the 'maxTiles' most recently read are kept, so
+ * memory doesn't grow with the size of the map, and reading can start
+ * before most of it exists. safe to read from many threads at once.
+ */
+struct Heightmap
+{
+    static const int TILE = 256;
+
+    const int size;
+    const int border;
+    const int width;
+
+    Heightmap(int _size, int _border, int _width, TileSource *_source,
+            size_t _maxTiles = 64);
+
+    // copies the 'w' x 'h' heights from 'x', 'z' into 'out', in ZX order.
+    // unchecked: the rectangle must be inside the map!
+    void read(int x, int z, int w, int h, float *out) const;
+
+private:
+    typedef std::shared_ptr<const std::vector<float> > Tile;
+
+    // tile 'tx', 'tz' of the square, computed if it isn't kept
+    Tile tile(int tx, int tz) const;
+
+    const std::unique_ptr<TileSource> source; // owned
+    const size_t maxTiles;
+    const int tilesX; // per row of the square
+
+    struct Entry
+    {
+        Tile tile;
+        std::list<int>::iterator used; // in 'lru'
+    };
+
+    mutable std::mutex lock; // of the two below
+    mutable std::unordered_map<int, Entry> tiles; // by tz * tilesX + tx
+    mutable std::list<int> lru; // keys of 'tiles', most recently read first
+};
+
+#endif
@@ -1,8 +1,14 @@
 #include "lithosphere.hpp"
+#include "MersenneTwister.h"
+#include "parallel.h"
 #include "plate.hpp"
 #include "sqrdmd.h"
 
+#include <algorithm>
 #include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <vector>
 
@@ -29,6 +35,11 @@ class plateArea
 
 static const float SQRDMD_ROUGHNESS = 0.5f;
 
+static const size_t RASTER_TILE_ROWS = 32; ///< Height of raster tiles.
+
+/// Index map's value for "no owner". Plate count must stay below this.
+static const uint16_t NO_PLATE = 0xFFFF;
+
 static const float BUOYANCY_BONUS_X = 3;
 static const size_t MAX_BUOYANCY_AGE = 20;
 static const float MULINV_MAX_BUOYANCY_AGE = 1.0f / (float)MAX_BUOYANCY_AGE;
@@ -41,22 +52,26 @@ size_t findBound(const size_t* map, size_t length, size_t x0, size_t y0,
                  int dx, int dy);
 size_t findPlate(plate** plates, float x, float y, size_t num_plates);
 
-lithosphere::lithosphere(size_t map_side_length, float sea_level,
-	size_t _erosion_period, float _folding_ratio, size_t aggr_ratio_abs,
-	float aggr_ratio_rel, size_t num_cycles) throw(invalid_argument) :
-	hmap(0), plates(0), aggr_overlap_abs(aggr_ratio_abs),
-	aggr_overlap_rel(aggr_ratio_rel), cycle_count(0),
+lithosphere::lithosphere(size_t _map_width, size_t _map_height,
+	float sea_level, size_t _erosion_period, float _folding_ratio,
+	size_t aggr_ratio_abs, float aggr_ratio_rel, size_t num_cycles,
+	uint32_t _seed) throw(invalid_argument) :
+	hmap(0), imap(0), prev_imap(0), amap(0), plates(0),
+	aggr_overlap_abs(aggr_ratio_abs), aggr_overlap_rel(aggr_ratio_rel),
+	cycle_count(0), extension_count(0),
 	erosion_period(_erosion_period), folding_ratio(_folding_ratio),
-	iter_count(0), map_side(map_side_length + 1), max_cycles(num_cycles),
-	num_plates(0)
+	iter_count(0), map_width(_map_width), map_height(_map_height),
+	max_cycles(num_cycles), num_plates(0), partition(GROW_PLATES),
+	seed(_seed)
 {
-	const size_t A = map_side * map_side;
-	float* tmp = new float[A];
-	memset(tmp, 0, A * sizeof(float));
+	const size_t A = map_width * map_height;
+	hmap = new float[A];
+	float* const tmp = hmap; // Becomes the height map in place.
 
-	if (sqrdmd(tmp, map_side, SQRDMD_ROUGHNESS) < 0)
+	if (sqrdmd_wrapped(tmp, map_width, map_height, SQRDMD_ROUGHNESS,
+	    getStreamSeed(HEIGHT_STREAM, 0)) < 0)
 	{
-		delete[] tmp;
+		delete[] hmap;
 		throw invalid_argument("Failed to generate height map.");
 	}
 
@@ -100,71 +115,31 @@ lithosphere::lithosphere(size_t map_side_length, float sea_level,
 			(tmp[i] <= sea_level) * OCEANIC_BASE;
 	}
 
-	// Scalp the +1 away from map side to get a power of two side length!
-	// Practically only the redundant map edges become removed.
-	--map_side;
-	hmap = new float[map_side*map_side];
-	for (size_t i = 0; i < map_side; ++i)
-		memcpy(&hmap[i*map_side], &tmp[i*(map_side+1)],
-		      map_side*sizeof(float));
+	// World maps live as long as the lithosphere does. Index map is
+	// double buffered: update() swaps the two instead of reallocating.
+	imap = new uint16_t[A];
+	prev_imap = new uint16_t[A];
+	amap = new uint32_t[A];
 
-	imap = new size_t[map_side*map_side];
-	delete[] tmp;
+	// Tile count mustn't depend on thread count, see update().
+	overlaps.resize((map_height + RASTER_TILE_ROWS - 1) / RASTER_TILE_ROWS);
 }
 
 lithosphere::~lithosphere() throw()
 {
 	delete[] plates; plates = 0;
+	delete[] amap;   amap = 0;
+	delete[] prev_imap; prev_imap = 0;
 	delete[] imap;   imap = 0;
 	delete[] hmap;   hmap = 0;
 }
 
-void lithosphere::createPlates(size_t num_plates) throw()
+/// Grow plates from their origins in random order until the map is full.
+///
+/// Each round adds the neighbours of one random border point of every plate.
+static void growPlates(plateArea* area, size_t num_plates, uint16_t* owner,
+	size_t map_width, size_t map_height, MTRand& rng)
 {
-	const size_t map_area = map_side * map_side;
-	this->num_plates = num_plates;
-
-	std::vector<plateCollision> vec;
-	vec.reserve(map_side*4); // == map's circumference.
-
-	collisions.reserve(num_plates);
-	subductions.reserve(num_plates);
-
-	for (size_t i = 0; i < num_plates; ++i)
-	{
-		collisions.push_back(vec);
-		subductions.push_back(vec);
-	}
-
-	// Initialize "Free plate center position" lookup table.
-	// This way two plate centers will never be identical.
-	for (size_t i = 0; i < map_area; ++i)
-		imap[i] = i;
-
-	// Select N plate centers from the global map.
-	plateArea* area = new plateArea[num_plates];
-	for (size_t i = 0; i < num_plates; ++i)
-	{
-		// Randomly select an unused plate origin.
-		const size_t p = imap[(size_t)rand() % (map_area - i)];
-		const size_t y = p / map_side;
-		const size_t x = p - y * map_side;
-
-		area[i].lft = area[i].rgt = x; // Save origin...
-		area[i].top = area[i].btm = y;
-		area[i].wdt = area[i].hgt = 1;
-
-		area[i].border.reserve(8);
-		area[i].border.push_back(p); // ...and mark it as border.
-
-		// Overwrite used entry with last unused entry in array.
-		imap[p] = imap[map_area - i - 1];
-	}
-
-	size_t* owner = imap; // Create an alias.
-	memset(owner, 255, map_area * sizeof(size_t));
-
-	// "Grow" plates from their origins until surface is fully populated.
 	size_t max_border = 1;
 	size_t i;
 	while (max_border)
@@ -176,27 +151,28 @@ void lithosphere::createPlates(size_t num_plates) throw()
 			if (N == 0)
 				continue;
 
-			const size_t j = rand() % N;
+			const size_t j = rng.randInt() % N;
 			const size_t p = area[i].border[j];
-			const size_t cy = p / map_side;
-			const size_t cx = p - cy * map_side;
+			const size_t cy = p / map_width;
+			const size_t cx = p - cy * map_width;
 
-			const size_t lft = cx > 0 ? cx - 1 : map_side - 1;
-			const size_t rgt = cx < map_side - 1 ? cx + 1 : 0;
-			const size_t top = cy > 0 ? cy - 1 : map_side - 1;
-			const size_t btm = cy < map_side - 1 ? cy + 1 : 0;
+			const size_t lft = cx > 0 ? cx - 1 : map_width - 1;
+			const size_t rgt = cx < map_width - 1 ? cx + 1 : 0;
+			const size_t top = cy > 0 ? cy - 1 : map_height - 1;
+			const size_t btm = cy < map_height - 1 ? cy + 1 : 0;
 
-			const size_t n = top * map_side +  cx; // North.
-			const size_t s = btm * map_side +  cx; // South.
-			const size_t w =  cy * map_side + lft; // West.
-			const size_t e =  cy * map_side + rgt; // East.
+			const size_t n = top * map_width +  cx; // North.
+			const size_t s = btm * map_width +  cx; // South.
+			const size_t w =  cy * map_width + lft; // West.
+			const size_t e =  cy * map_width + rgt; // East.
 
 			if (owner[n] >= num_plates)
 			{
 				owner[n] = i;
 				area[i].border.push_back(n);
 
-				if (area[i].top == ((top + 1) & (map_side-1)))
+				if (area[i].top == (top + 1 < map_height ?
+				                    top + 1 : 0))
 				{
 					area[i].top = top;
 					area[i].hgt++;
@@ -208,7 +184,8 @@ void lithosphere::createPlates(size_t num_plates) throw()
 				owner[s] = i;
 				area[i].border.push_back(s);
 
-				if (btm == ((area[i].btm + 1) & (map_side-1)))
+				if (btm == (area[i].btm + 1 < map_height ?
+				            area[i].btm + 1 : 0))
 				{
 					area[i].btm = btm;
 					area[i].hgt++;
@@ -220,7 +197,8 @@ void lithosphere::createPlates(size_t num_plates) throw()
 				owner[w] = i;
 				area[i].border.push_back(w);
 
-				if (area[i].lft == ((lft + 1) & (map_side-1)))
+				if (area[i].lft == (lft + 1 < map_width ?
+				                    lft + 1 : 0))
 				{
 					area[i].lft = lft;
 					area[i].wdt++;
@@ -232,7 +210,8 @@ void lithosphere::createPlates(size_t num_plates) throw()
 				owner[e] = i;
 				area[i].border.push_back(e);
 
-				if (rgt == ((area[i].rgt + 1) & (map_side-1)))
+				if (rgt == (area[i].rgt + 1 < map_width ?
+				            area[i].rgt + 1 : 0))
 				{
 					area[i].rgt = rgt;
 					area[i].wdt++;
@@ -244,13 +223,412 @@ void lithosphere::createPlates(size_t num_plates) throw()
 			area[i].border.pop_back();
 		}
 
+}
+
+/// Hash integer lattice coordinates into a value in range [-1, 1].
+static float latticeNoise(uint32_t x, uint32_t y, uint32_t seed)
+{
+	uint32_t h = seed ^ (x * 0x9E3779B1u) ^ (y * 0x85EBCA77u);
+	h ^= h >> 16; h *= 0x7FEB352Du;
+	h ^= h >> 15; h *= 0x846CA68Bu;
+	h ^= h >> 16;
+
+	return h * (2.0f / 4294967295.0f) - 1.0f;
+}
+
+/**
+ * Smooth value noise that wraps around world edges.
+ *
+ * Random values are placed on a lattice and interpolated between. Lattice
+ * cells fit a whole number of times along either side of the world, so they
+ * may be a little longer or shorter than requested.
+ */
+class wrappingNoise
+{
+  public:
+
+	/// @param	map_width Width of the world.
+	/// @param	map_height Height of the world.
+	/// @param	cell	Distance of lattice points.
+	/// @param	seed	Seed of the random lattice values.
+	wrappingNoise(size_t map_width, size_t map_height, size_t cell,
+		uint32_t seed) throw() :
+		cols(latticeLength(map_width, cell)),
+		lattice(cols * latticeLength(map_height, cell))
+	{
+		const size_t rows = lattice.size() / cols;
+		for (size_t y = 0, i = 0; y < rows; ++y)
+			for (size_t x = 0; x < cols; ++x, ++i)
+				lattice[i] = latticeNoise(x, y, seed);
+
+		axis(map_width, cols, col0, col1, fx);
+		axis(map_height, rows, row0, row1, fy);
+	}
+
+	/// Number of values interpolateRow() produces.
+	size_t getRowLength() const throw() { return cols; }
+
+	/// Interpolate lattice values vertically for a row of the world.
+	///
+	/// @param	y	Row on world map.
+	/// @param[out] out	One value per lattice column.
+	void interpolateRow(size_t y, float* out) const throw()
+	{
+		const float* const r0 = &lattice[row0[y] * cols];
+		const float* const r1 = &lattice[row1[y] * cols];
+		const float w = fy[y];
+
+		for (size_t x = 0; x < cols; ++x)
+			out[x] = r0[x] * (1 - w) + r1[x] * w;
+	}
+
+	/// Noise at a column of a row given values from interpolateRow().
+	float sample(const float* row, size_t x) const throw()
+	{
+		return row[col0[x]] * (1 - fx[x]) + row[col1[x]] * fx[x];
+	}
+
+  private:
+
+	/// Number of lattice points along a side of "length" points.
+	static size_t latticeLength(size_t length, size_t cell) throw()
+	{
+		const size_t n = (length + cell / 2) / cell;
+		return n > 0 ? n : 1;
+	}
+
+	/// Tabulate the lattice points before and after each point of a side
+	/// and the smoothed weight of the latter, wrapping around the side.
+	static void axis(size_t length, size_t points,
+		std::vector<uint32_t>& first, std::vector<uint32_t>& second,
+		std::vector<float>& weight) throw()
+	{
+		first.resize(length);
+		second.resize(length);
+		weight.resize(length);
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			const size_t pos = i * points;
+			const float f = (pos % length) / (float)length;
+
+			first[i] = pos / length;
+			second[i] = first[i] + 1 < points ? first[i] + 1 : 0;
+			weight[i] = f * f * (3 - 2 * f);
+		}
+	}
+
+	size_t cols; ///< Number of lattice points along X axis.
+	std::vector<float> lattice; ///< Random value of each lattice point.
+	std::vector<uint32_t> col0, col1; ///< Lattice columns around each x.
+	std::vector<uint32_t> row0, row1; ///< Lattice rows around each y.
+	std::vector<float> fx, fy; ///< Smoothed weight of the latter of them.
+};
+
+/// Find the smallest range that covers all set flags of a circular array.
+///
+/// @param	used	Flag of each position, at least one of them is set.
+/// @param	length	Number of positions.
+/// @param[out] first	First position of the range.
+/// @return	Number of positions in the range.
+static size_t wrappedExtent(const std::vector<char>& used, size_t length,
+	size_t* first)
+{
+	size_t start = 0;
+	while (!used[start])
+		++start;
+
+	// Range begins after the longest run of unused positions. Going
+	// once around from a used position finds all runs.
+	size_t gap = 0, longest_gap = 0;
+	*first = start;
+	for (size_t k = 1; k <= length; ++k)
+	{
+		const size_t i = (start + k) % length;
+		if (!used[i])
+		{
+			++gap;
+			continue;
+		}
+
+		if (gap > longest_gap)
+		{
+			longest_gap = gap;
+			*first = i;
+		}
+
+		gap = 0;
+	}
+
+	return length - longest_gap;
+}
+
+/// Squared distance between two points around the edges of the world.
+static uint32_t wrappedDistance(uint32_t x0, uint32_t y0, uint32_t x1,
+	uint32_t y1, uint32_t map_width, uint32_t map_height)
+{
+	uint32_t dx = x0 > x1 ? x0 - x1 : x1 - x0;
+	uint32_t dy = y0 > y1 ? y0 - y1 : y1 - y0;
+	dx = dx < map_width - dx ? dx : map_width - dx;
+	dy = dy < map_height - dy ? dy : map_height - dy;
+	return dx * dx + dy * dy;
+}
+
+/// Distance along one axis from a site to the nearest and the farthest
+/// point of a range of "length" points, around the edges of the world.
+static void axisDistance(uint32_t site, uint32_t first, uint32_t length,
+	uint32_t side, uint32_t* near, uint32_t* far)
+{
+	const uint32_t u = site >= first ? site - first : site + side - first;
+	const uint32_t before = side - u;
+
+	*near = u < length ? 0 : (u - length + 1 < before ?
+		u - length + 1 : before);
+	*far = *near + length - 1 < side / 2 ?
+		*near + length - 1 : side / 2;
+}
+
+/// Find the nearest site of each point, ties going to the smallest index.
+///
+/// Map is processed in square tiles in parallel, those at the right and
+/// bottom edges may be cut short. Every tile first drops the sites that are
+/// farther from all of its points than some other site is from any of them,
+/// which leaves only a handful of candidates.
+static void findNearestSites(uint16_t* cell, const std::vector<uint32_t>& sx,
+	const std::vector<uint32_t>& sy, size_t map_width, size_t map_height)
+{
+	const size_t MAX_TILE = 32;
+	const size_t tiles_x = (map_width + MAX_TILE - 1) / MAX_TILE;
+	const size_t tiles_y = (map_height + MAX_TILE - 1) / MAX_TILE;
+	const size_t num_sites = sx.size();
+
+	parallel_for(tiles_x * tiles_y, [&](int t)
+	{
+		const size_t x0 = t % tiles_x * MAX_TILE;
+		const size_t y0 = t / tiles_x * MAX_TILE;
+		const size_t tile_w = std::min(MAX_TILE, map_width - x0);
+		const size_t tile_h = std::min(MAX_TILE, map_height - y0);
+		std::vector<uint32_t> near(num_sites);
+		std::vector<uint32_t> candidate;
+		uint32_t bound = (uint32_t)-1;
+
+		for (size_t i = 0; i < num_sites; ++i)
+		{
+			uint32_t nx, ny, fx, fy;
+			axisDistance(sx[i], x0, tile_w, map_width, &nx, &fx);
+			axisDistance(sy[i], y0, tile_h, map_height, &ny, &fy);
+
+			near[i] = nx * nx + ny * ny;
+			bound = fx * fx + fy * fy < bound ?
+				fx * fx + fy * fy : bound;
+		}
+
+		for (size_t i = 0; i < num_sites; ++i)
+			if (near[i] <= bound)
+				candidate.push_back(i);
+
+		uint32_t best[MAX_TILE];
+		for (size_t y = y0; y < y0 + tile_h; ++y)
+		{
+			uint16_t* const row = &cell[y * map_width + x0];
+			std::fill_n(best, tile_w, (uint32_t)-1);
+
+			for (size_t c = 0; c < candidate.size(); ++c)
+			{
+			  const uint32_t i = candidate[c];
+			  for (size_t x = 0; x < tile_w; ++x)
+			  {
+				const uint32_t d = wrappedDistance(x0 + x, y,
+					sx[i], sy[i], map_width, map_height);
+				row[x] = d < best[x] ? i : row[x];
+				best[x] = d < best[x] ? d : best[x];
+			  }
+			}
+		}
+	});
+}
+
+/// Split the map into noisy Voronoi cells around plates' origins.
+///
+/// Each point takes the owner of the cell at a slightly displaced location,
+/// which makes the borders irregular. All points of the map get an owner
+/// and each area gets bounds that cover its points, wrapping around world
+/// edges when necessary. Work is done in parallel.
+static void partitionVoronoi(plateArea* area, size_t num_plates,
+	uint16_t* owner, size_t map_width, size_t map_height, uint32_t seed)
+{
+	const size_t map_area = map_width * map_height;
+	const size_t map_side = std::min(map_width, map_height); // Shorter.
+	std::vector<uint32_t> sx(num_plates), sy(num_plates);
+	uint16_t* nearest = new uint16_t[map_area];
+
+	for (size_t i = 0; i < num_plates; ++i)
+	{
+		sx[i] = area[i].lft;
+		sy[i] = area[i].top;
+	}
+
+	findNearestSites(nearest, sx, sy, map_width, map_height);
+
+	// Displace lookups by a few octaves of noise. Lattice of the coarsest
+	// one is a quarter to a half of the size of an average cell. It isn't
+	// larger than the world, so lookups are never displaced by more than
+	// its side.
+	size_t coarse = 4;
+	while (coarse * 4 * coarse * 4 * num_plates <= map_area &&
+	       coarse * 2 <= map_side)
+		coarse *= 2;
+
+	std::vector<wrappingNoise> noise_x, noise_y;
+	std::vector<float> amplitude;
+	for (size_t c = coarse; c >= 2 && amplitude.size() < 3; c /= 4)
+	{
+		noise_x.push_back(wrappingNoise(map_width, map_height, c,
+			seed++));
+		noise_y.push_back(wrappingNoise(map_width, map_height, c,
+			seed++));
+		amplitude.push_back(0.5f * c);
+	}
+
+	parallel_for(map_height, [&](int y)
+	{
+	  std::vector<std::vector<float> > row_x(amplitude.size());
+	  std::vector<std::vector<float> > row_y(amplitude.size());
+	  for (size_t o = 0; o < amplitude.size(); ++o)
+	  {
+		row_x[o].resize(noise_x[o].getRowLength());
+		row_y[o].resize(noise_y[o].getRowLength());
+		noise_x[o].interpolateRow(y, &row_x[o][0]);
+		noise_y[o].interpolateRow(y, &row_y[o][0]);
+	  }
+
+	  for (size_t x = 0; x < map_width; ++x)
+	  {
+		float dx = 0, dy = 0;
+		for (size_t o = 0; o < amplitude.size(); ++o)
+		{
+			dx += amplitude[o] * noise_x[o].sample(&row_x[o][0], x);
+			dy += amplitude[o] * noise_y[o].sample(&row_y[o][0], x);
+		}
+
+		ptrdiff_t wx = x + (ptrdiff_t)floorf(dx + 0.5f);
+		ptrdiff_t wy = y + (ptrdiff_t)floorf(dy + 0.5f);
+		wx += wx < 0 ? map_width : 0;
+		wx -= wx < (ptrdiff_t)map_width ? 0 : map_width;
+		wy += wy < 0 ? map_height : 0;
+		wy -= wy < (ptrdiff_t)map_height ? 0 : map_height;
+		owner[y * map_width + x] = nearest[wy * map_width + wx];
+	  }
+	});
+
+	// Displacement may skip a cell entirely. Origins stay with their own
+	// plates so that no plate is left empty.
+	for (size_t i = 0; i < num_plates; ++i)
+		owner[sy[i] * map_width + sx[i]] = i;
+
+	// Gather rows and columns that each plate occupies. Tasks own either
+	// rows or columns, so no two of them write to the same flag.
+	const size_t band = 64;
+	std::vector<std::vector<char> > rows(num_plates,
+		std::vector<char>(map_height, 0));
+	std::vector<std::vector<char> > cols(num_plates,
+		std::vector<char>(map_width, 0));
+
+	parallel_for(map_height, [&](int y)
+	{
+		for (size_t x = 0; x < map_width; ++x)
+			rows[owner[y * map_width + x]][y] = 1;
+	});
+
+	parallel_for((map_width + band - 1) / band, [&](int b)
+	{
+		const size_t x1 = std::min((b + 1) * band, map_width);
+		for (size_t y = 0; y < map_height; ++y)
+		  for (size_t x = b * band; x < x1; ++x)
+			cols[owner[y * map_width + x]][x] = 1;
+	});
+
+	for (size_t i = 0; i < num_plates; ++i)
+	{
+		area[i].wdt = wrappedExtent(cols[i], map_width, &area[i].lft);
+		area[i].hgt = wrappedExtent(rows[i], map_height, &area[i].top);
+		area[i].rgt = area[i].lft + area[i].wdt - 1;
+		area[i].rgt -= area[i].rgt < map_width ? 0 : map_width;
+		area[i].btm = area[i].top + area[i].hgt - 1;
+		area[i].btm -= area[i].btm < map_height ? 0 : map_height;
+	}
+
+	delete[] nearest;
+}
+
+void lithosphere::createPlates(size_t num_plates) throw()
+{
+	const size_t map_area = map_width * map_height;
+	this->num_plates = num_plates;
+
+	std::vector<plateCollision> vec;
+	vec.reserve((map_width + map_height) * 2); // == map's circumference.
+
+	collisions.reserve(num_plates);
+	subductions.reserve(num_plates);
+
+	for (size_t i = 0; i < num_plates; ++i)
+	{
+		collisions.push_back(vec);
+		subductions.push_back(vec);
+	}
+
+	if (erosion_time.size() < num_plates)
+		erosion_time.resize(num_plates, 0);
+
+	// Initialize "Free plate center position" lookup table.
+	// This way two plate centers will never be identical.
+	// Age map isn't in use until the next update, borrow it.
+	uint32_t* const center = amap;
+	for (size_t i = 0; i < map_area; ++i)
+		center[i] = i;
+
+	// Select N plate centers from the global map.
+	MTRand rng(getStreamSeed(PARTITION_STREAM, 0));
+	plateArea* area = new plateArea[num_plates];
+	for (size_t i = 0; i < num_plates; ++i)
+	{
+		// Randomly select an unused plate origin.
+		const size_t p = center[(size_t)rng.randInt() % (map_area - i)];
+		const size_t y = p / map_width;
+		const size_t x = p - y * map_width;
+
+		area[i].lft = area[i].rgt = x; // Save origin...
+		area[i].top = area[i].btm = y;
+		area[i].wdt = area[i].hgt = 1;
+
+		area[i].border.reserve(8);
+		area[i].border.push_back(p); // ...and mark it as border.
+
+		// Overwrite used entry with last unused entry in array.
+		center[p] = center[map_area - i - 1];
+	}
+
+	uint16_t* owner = imap; // Create an alias.
+	std::fill_n(owner, map_area, NO_PLATE);
+
+	// "Grow" plates from their origins until surface is fully populated.
+	if (partition == NOISY_VORONOI)
+		partitionVoronoi(area, num_plates, owner, map_width,
+			map_height, rng.randInt());
+	else
+		growPlates(area, num_plates, owner, map_width, map_height,
+			rng);
+
 	plates = new plate*[num_plates];
 
 	// Extract and create plates from initial terrain.
 	for (size_t i = 0; i < num_plates; ++i)
 	{
-		area[i].wdt = area[i].wdt<map_side ? area[i].wdt : map_side-1;
-		area[i].hgt = area[i].hgt<map_side ? area[i].hgt : map_side-1;
+		area[i].wdt = area[i].wdt < map_width ?
+			area[i].wdt : map_width - 1;
+		area[i].hgt = area[i].hgt < map_height ?
+			area[i].hgt : map_height - 1;
 
 		const size_t x0 = area[i].lft;
 		const size_t x1 = 1 + x0 + area[i].wdt;
@@ -264,16 +642,22 @@ void lithosphere::createPlates(size_t num_plates) throw()
 //			height);
 
 		// Copy plate's height data from global map into local map.
+		// Plate is at most as large as the world, so it wraps around
+		// the world's edges at most once.
 		for (size_t y = y0, j = 0; y < y1; ++y)
+		{
+			const size_t y_mod = y < map_height ? y : y - map_height;
 			for (size_t x = x0; x < x1; ++x, ++j)
 			{
-				size_t k = (y & (map_side - 1)) * map_side +
-				           (x & (map_side - 1));
+				const size_t k = y_mod * map_width +
+					(x < map_width ? x : x - map_width);
 				plt[j] = hmap[k] * (owner[k] == i);
 			}
+		}
 
 		// Create plate.
-		plates[i] = new plate(plt, width, height, x0, y0, i, map_side);
+		plates[i] = new plate(plt, width, height, x0, y0, i, map_width,
+			map_height, getStreamSeed(PLATE_STREAM, i));
 		delete[] plt;
 	}
 
@@ -288,6 +672,15 @@ size_t lithosphere::getPlateCount() const throw()
 	return num_plates;
 } 
 
+size_t lithosphere::getExtensionCount() const throw()
+{
+	size_t count = extension_count;
+	for (size_t i = 0; i < num_plates; ++i)
+		count += plates[i]->getExtensionCount();
+
+	return count;
+}
+
 const float* lithosphere::getTopography() const throw()
 {
 	return hmap;
@@ -324,10 +717,27 @@ void lithosphere::update() throw()
 		return;
 	}
 
-	const size_t map_area = map_side * map_side;
-	const size_t* prev_imap = imap;
-	size_t* amap = new size_t[map_area];
-	imap = new size_t[map_area];
+	const size_t map_area = map_width * map_height;
+
+	// Previous index map becomes the back buffer and its old contents
+	// are overwritten with the new index map.
+	uint16_t* const tmp = prev_imap;
+	prev_imap = imap;
+	imap = tmp;
+
+	// Plates erode independently of each other. Each one records its own
+	// time so that the cost of the step can be told apart per plate.
+	if (erosion_period > 0 && iter_count % erosion_period == 0)
+		parallel_for(num_plates, [this](int i)
+		{
+			const std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+
+			plates[i]->erode(CONTINENTAL_BASE);
+
+			erosion_time[i] += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+		});
 
 	// Realize accumulated external forces to each plate.
 	for (size_t i = 0; i < num_plates; ++i)
@@ -342,14 +752,12 @@ void lithosphere::update() throw()
 			continue;
 		}
 
-		plates[i]->resetSegments();
-
-		if (erosion_period > 0 && iter_count % erosion_period == 0)
-			plates[i]->erode(CONTINENTAL_BASE);
-
 		plates[i]->move();
 	}
 
+	// Continents are looked up from segments found before any collision.
+	parallel_for(num_plates, [this](int i) { plates[i]->findSegments(); });
+
 //	static size_t max_collisions = 0;	// DEBUG!!!
 	size_t oceanic_collisions = 0;
 	size_t continental_collisions = 0;
@@ -359,41 +767,25 @@ void lithosphere::update() throw()
 	// Each plate's map's memory area is accessed sequentially and only
 	// once as opposed to calculating "num_plates" indices within plate
 	// maps in order to find out which plate(s) own current location.
-	memset(hmap,   0, map_area * sizeof(float));
-	memset(imap, 255, map_area * sizeof(size_t));
-	for (size_t i = 0; i < num_plates; ++i)
-	{
-	  const size_t x0 = (size_t)plates[i]->getLeft();
-	  const size_t y0 = (size_t)plates[i]->getTop();
-	  const size_t x1 = x0 + plates[i]->getWidth();
-	  const size_t y1 = y0 + plates[i]->getHeight();
-
-	  const float*  this_map;
-	  const size_t* this_age;
-	  plates[i]->getMap(&this_map, &this_age);
-
-	  // Copy first part of plate onto world map.
-	  for (size_t y = y0, j = 0; y < y1; ++y)
-	    for (size_t x = x0; x < x1; ++x, ++j)
-	    {
-		const size_t x_mod = x & (map_side - 1);
-		const size_t y_mod = y & (map_side - 1);
-
-		const size_t k = y_mod * map_side + x_mod;
-
-		if (this_map[j] < 2 * FLT_EPSILON) // No crust here...
-			continue;
-
-		if (imap[k] >= num_plates) // No one here yet?
-		{
-			// This plate becomes the "owner" of current location
-			// if it is the first plate to have crust on it.
-			hmap[k] = this_map[j];
-			imap[k] = i;
-			amap[k] = this_age[j];
+	//
+	// World is split into horizontal tiles which are rasterized in
+	// parallel. Points where plates overlap are collected per tile and
+	// resolved below tile by tile in a fixed order. This way the outcome
+	// doesn't depend on the number of threads.
+	parallel_for(overlaps.size(), [this](int t) { rasterizeTile(t); });
+
+	for (size_t t = 0; t < overlaps.size(); ++t)
+	  for (size_t n = 0; n < overlaps[t].size(); ++n)
+	  {
+		const size_t i = overlaps[t][n].index;
+		const size_t j = overlaps[t][n].j;
+		const size_t k = overlaps[t][n].k;
+		const size_t y_mod = k / map_width;
+		const size_t x_mod = k - y_mod * map_width;
 
-			continue;
-		}
+		const float*  this_map;
+		const uint32_t* this_age;
+		plates[i]->getMap(&this_map, &this_age);
 
 		// DO NOT ACCEPT HEIGHT EQUALITY! Equality leads to subduction
 		// of shore that 's barely above sea level. It's a lot less
@@ -504,17 +896,16 @@ void lithosphere::update() throw()
 			imap[k] = i;
 			amap[k] = this_age[j];
 		}
-	    }
-	}
+	  }
 
 //	size_t total_collisions = oceanic_collisions + continental_collisions;
 //	if (total_collisions > max_collisions)
 //		max_collisions = total_collisions;
 //	printf("%5u + %5u = %5u collisions (%f %%) (max %5u (%f %%)). %c\n",
 //		oceanic_collisions, continental_collisions, total_collisions,
-//		(float)total_collisions / (float)(map_side * map_side),
+//		(float)total_collisions / (float)(map_width * map_height),
 //		max_collisions, (float)max_collisions /
-//		(float)(map_side * map_side), '+' + (2 & -(iter_count & 1)));
+//		(float)(map_width * map_height), '+' + (2 & -(iter_count & 1)));
 
 	// Update the counter of iterations since last continental collision.
 	last_coll_count = (last_coll_count + 1) &
@@ -565,7 +956,7 @@ void lithosphere::update() throw()
 			// Collision causes friction. Apply it to both plates.
 			plates[i]->applyFriction(coll.crust);
 			plates[coll.index]->applyFriction(coll.crust);
-//			hmap[coll.wy * map_side + coll.wx] = 0;
+//			hmap[coll.wy * map_width + coll.wx] = 0;
 
 			plates[i]->getCollisionInfo(coll.wx, coll.wy,
 				&coll_count_i, &coll_ratio_i);
@@ -614,8 +1005,8 @@ void lithosphere::update() throw()
 	  }
 
 	// Fill divergent boundaries with new crustal material, molten magma.
-	for (size_t y = 0, i = 0; y < BOOL_REGENERATE_CRUST * map_side; ++y)
-	  for (size_t x = 0; x < map_side; ++x, ++i)
+	for (size_t y = 0, i = 0; y < BOOL_REGENERATE_CRUST * map_height; ++y)
+	  for (size_t x = 0; x < map_width; ++x, ++i)
 		if (imap[i] >= num_plates)
 		{
 			// The owner of this new crust is that neighbour plate
@@ -646,8 +1037,8 @@ void lithosphere::update() throw()
 //			size_t px = (size_t) plates[imap[i]]->left + lx;
 //			size_t py = (size_t) plates[imap[i]]->top + ly;
 //
-//			if ((py & (map_side - 1)) * map_side +
-//				(px & (map_side - 1)) != i)
+//			if (py % map_height * map_width +
+//				px % map_width != i)
 //			{
 //				puts("Added sea floor to odd place!");
 //				exit(1);
@@ -680,7 +1071,7 @@ void lithosphere::update() throw()
 	const size_t y1 = y0 + plates[i]->getHeight();
 
 	const float*  this_map;
-	const size_t* this_age;
+	const uint32_t* this_age;
 	plates[i]->getMap(&this_map, &this_age);
 
 	// Show only plate[0]'s segments, draw everything else dark blue.
@@ -688,10 +1079,10 @@ void lithosphere::update() throw()
 	for (size_t y = y0, j = 0; y < y1; ++y)
 	  for (size_t x = x0; x < x1; ++x, ++j)
 	  {
-		const size_t x_mod = x & (map_side - 1);
-		const size_t y_mod = y & (map_side - 1);
+		const size_t x_mod = x % map_width;
+		const size_t y_mod = y % map_height;
 
-		const size_t k = y_mod * map_side + x_mod;
+		const size_t k = y_mod * map_width + x_mod;
 
 		if (this_map[j] < 2 * FLT_EPSILON) // No crust here...
 		{
@@ -703,15 +1094,84 @@ void lithosphere::update() throw()
 		hmap[k] = (this_map[j] * Q);
 	  }*/
 
-	delete[] amap;
-	delete[] prev_imap;
 	++iter_count;
 }
 
+void lithosphere::rasterizeTile(size_t tile) throw()
+{
+	const size_t row_begin = tile * RASTER_TILE_ROWS;
+	const size_t row_end = row_begin + RASTER_TILE_ROWS < map_height ?
+		row_begin + RASTER_TILE_ROWS : map_height;
+	const size_t tile_area = (row_end - row_begin) * map_width;
+
+	std::vector<plateOverlap>& overlap = overlaps[tile];
+	overlap.clear();
+
+	memset(&hmap[row_begin * map_width], 0, tile_area * sizeof(float));
+	std::fill_n(&imap[row_begin * map_width], tile_area, NO_PLATE);
+	for (size_t i = 0; i < num_plates; ++i)
+	{
+	  const size_t x0 = (size_t)plates[i]->getLeft();
+	  const size_t y0 = (size_t)plates[i]->getTop();
+	  const size_t width = plates[i]->getWidth();
+	  const size_t height = plates[i]->getHeight();
+
+	  const float*  this_map;
+	  const uint32_t* this_age;
+	  const uint32_t* row_x0;
+	  const uint32_t* row_x1;
+	  plates[i]->getMap(&this_map, &this_age);
+	  plates[i]->getRowExtents(&row_x0, &row_x1);
+
+	  // Plate is at most as large as the world, so it wraps around the
+	  // world's edges at most once.
+	  for (size_t y = 0; y < height; ++y)
+	  {
+	    const size_t y_mod = y0 + y < map_height ? y0 + y :
+		y0 + y - map_height;
+	    if (y_mod < row_begin || y_mod >= row_end)
+		continue; // Row belongs to some other tile.
+
+	    // Plates' maps are mostly empty, visit only the part with crust.
+	    for (size_t x = row_x0[y], j = y * width + x; x < row_x1[y];
+	         ++x, ++j)
+	    {
+		const size_t x_mod = x0 + x < map_width ? x0 + x :
+			x0 + x - map_width;
+		const size_t k = y_mod * map_width + x_mod;
+
+		if (this_map[j] < 2 * FLT_EPSILON) // No crust here...
+			continue;
+
+		if (imap[k] >= num_plates) // No one here yet?
+		{
+			// This plate becomes the "owner" of current location
+			// if it is the first plate to have crust on it.
+			hmap[k] = this_map[j];
+			imap[k] = i;
+			amap[k] = this_age[j];
+
+			continue;
+		}
+
+		overlap.push_back(plateOverlap(i, j, k));
+	    }
+	  }
+	}
+}
+
+uint32_t lithosphere::getStreamSeed(randomStream stream, size_t index) const
+	throw()
+{
+	MTRand::uint32 key[] = { seed, cycle_count, stream, index };
+	MTRand rng(key, sizeof(key) / sizeof(key[0]));
+
+	return rng.randInt();
+}
+
 void lithosphere::restart() throw()
 {
-	const size_t map_area = map_side * map_side;
-	size_t* amap = new size_t[map_area];
+	const size_t map_area = map_width * map_height;
 
 	cycle_count += max_cycles > 0; // No increment if running for ever.
 	if (cycle_count > max_cycles)
@@ -727,22 +1187,25 @@ void lithosphere::restart() throw()
 	  const size_t y1 = y0 + plates[i]->getHeight();
 
 	  const float*  this_map;
-	  const size_t* this_age;
+	  const uint32_t* this_age;
 	  plates[i]->getMap(&this_map, &this_age);
 
 	  // Copy first part of plate onto world map.
 	  for (size_t y = y0, j = 0; y < y1; ++y)
 	    for (size_t x = x0; x < x1; ++x, ++j)
 	    {
-		const size_t x_mod = x & (map_side - 1);
-		const size_t y_mod = y & (map_side - 1);
+		const size_t x_mod = x < map_width ? x : x - map_width;
+		const size_t y_mod = y < map_height ? y : y - map_height;
 
-		hmap[y_mod * map_side + x_mod] += this_map[j];
-		amap[y_mod * map_side + x_mod]  = this_age[j];
+		hmap[y_mod * map_width + x_mod] += this_map[j];
+		amap[y_mod * map_width + x_mod]  = this_age[j];
 	    }
 	}
 
 	// Delete plates.
+	for (size_t i = 0; i < num_plates; ++i)
+		extension_count += plates[i]->getExtensionCount();
+
 	delete[] plates;
 	plates = 0;
 
@@ -750,7 +1213,6 @@ void lithosphere::restart() throw()
 	// However, if max cycle count is "ETERNITY", then 0 < 0 + 1 always.
 	if (cycle_count < max_cycles + !max_cycles)
 	{
-		delete[] amap;
 		createPlates(num_plates);
 		return;
 	}
@@ -769,23 +1231,15 @@ void lithosphere::restart() throw()
 	}
 
 	// This is the LAST cycle! Add some random noise to the map.
-	size_t A = (map_side + 1)*(map_side + 1);
-	float* tmp = new float[A];
-	memset(tmp, 0, A * sizeof(float));
+	float* tmp = new float[map_area];
 
-	if (sqrdmd(tmp, map_side + 1, SQRDMD_ROUGHNESS) < 0)
+	if (sqrdmd_wrapped(tmp, map_width, map_height, SQRDMD_ROUGHNESS,
+	    getStreamSeed(NOISE_STREAM, 0)) < 0)
 	{
-		delete[] amap;
 		delete[] tmp;
 		throw invalid_argument("Failed to generate height map again.");
 	}
 
-	// Shrink the fractal map by 1 pixel from right and bottom.
-	// This makes it same size as lithosphere's height map.
-	for (size_t i = 0; i < map_side; ++i)
-		memmove(&tmp[i*map_side], &tmp[i*(map_side+1)],
-		      map_side*sizeof(float));
-
 	float t_lowest = tmp[0], t_highest = tmp[0];
 	float h_lowest = hmap[0], h_highest = hmap[0];
 	for (size_t i = 1; i < map_area; ++i)
@@ -812,7 +1266,6 @@ void lithosphere::restart() throw()
 			hmap[i] = 0.8 *hmap[i] + 0.2 *tmp[i] *CONTINENTAL_BASE;
 	}
 
-	delete[] amap;
 	delete[] tmp;
 }
 
@@ -3,6 +3,7 @@
 
 #include <cstring> // For size_t.
 #include <stdexcept>
+#include <stdint.h>
 #include <vector>
 
 #define CONTINENTAL_BASE 1.0f
@@ -27,20 +28,24 @@ class lithosphere
 	/**
 	 * Initialize system's height map i.e. topography.
 	 *
-	 * @param map_side_length Square height map's side's length in pixels.
+	 * Height map wraps around its edges, any size is fine.
+	 *
+	 * @param _map_width Height map's width in pixels.
+	 * @param _map_height Height map's height in pixels.
 	 * @param sea_level Amount of surcafe area that becomes oceanic crust.
 	 * @param _erosion_period # of iterations between global erosion.
 	 * @param _folding_ratio Percent of overlapping crust that's folded.
 	 * @param aggr_ratio_abs # of overlapping points causing aggregation.
 	 * @param aggr_ratio_rel % of overlapping area causing aggregation.
 	 * @param num_cycles Number of times system will be restarted.
-	 * @exception	invalid_argument Exception is thrown if map side length
-	 *           	is not a power of two and greater than three.
+	 * @param _seed Seed of all random numbers used by the simulation.
+	 * @exception	invalid_argument Exception is thrown if height map
+	 *           	couldn't be generated.
 	 */
-	lithosphere(size_t map_side_length, float sea_level,
+	lithosphere(size_t _map_width, size_t _map_height, float sea_level,
 		size_t _erosion_period, float _folding_ratio,
 		size_t aggr_ratio_abs, float aggr_ratio_rel,
-		size_t num_cycles) throw(std::invalid_argument);
+		size_t num_cycles, uint32_t _seed) throw(std::invalid_argument);
 
 	~lithosphere() throw(); ///< Standard destructor.
 
@@ -53,12 +58,30 @@ class lithosphere
 	 */
 	void createPlates(size_t num_plates) throw();
 
+	/// Methods of dividing the world into plates.
+	enum partitionMethod
+	{
+		GROW_PLATES, ///< Grow plates from origins in random order.
+		NOISY_VORONOI ///< Split into noisy Voronoi cells in parallel.
+	};
+
+	/// Select how createPlates() divides the world, growing by default.
+	void setPartitionMethod(partitionMethod method) throw()
+		{ partition = method; }
+
 	size_t getCycleCount() const throw() { return cycle_count; }
 	size_t getIterationCount() const throw() { return iter_count; }
 	size_t getPlateCount() const throw(); ///< Return number of plates.
+	size_t getExtensionCount() const throw(); ///< N:o of plate growths.
 	const float* getTopography() const throw(); ///< Return height map.
+	size_t getWidth() const throw() { return map_width; }
+	size_t getHeight() const throw() { return map_height; }
 	void update() throw(); ///< Simulate one step of plate tectonics.
 
+	/// Return seconds spent in erosion by each plate index, all cycles.
+	const std::vector<double>& getErosionTimes() const throw()
+		{ return erosion_time; }
+
   protected:
   private:
 
@@ -89,24 +112,84 @@ class lithosphere
 		float crust; ///< Amount of crust that will deform/subduct.
 	};
 
+	/**
+	 * Location where a plate's crust lands on an already owned pixel.
+	 *
+	 * Overlaps are gathered while tiles are rasterized in parallel and
+	 * they are resolved afterwards one tile at a time in a fixed order.
+	 * Resolving involves plate wide bookkeeping (mass, continent
+	 * segments), which tiles processed concurrently mustn't touch.
+	 */
+	class plateOverlap
+	{
+	  public:
+
+		plateOverlap(size_t _index, size_t _local, size_t _world)
+			throw() : index(_index), j(_local), k(_world) {}
+
+		size_t index; ///< Index of the plate that overlaps.
+		size_t j; ///< Offset of the point within plate's map.
+		size_t k; ///< Offset of the point within world map.
+	};
+
+	/**
+	 * Copy all plates' crust within one horizontal tile to world maps.
+	 *
+	 * Points which more than one plate covers are left for the caller,
+	 * see plateOverlap.
+	 *
+	 * @param tile Index of the tile to rasterize.
+	 */
+	void rasterizeTile(size_t tile) throw();
+
 	void restart() throw(); //< Replace plates with a new population.
 
+	/// Parts of the simulation that draw random numbers.
+	enum randomStream
+	{
+		HEIGHT_STREAM, ///< Initial fractal height map.
+		PARTITION_STREAM, ///< Plate origins and their growth.
+		PLATE_STREAM, ///< Motion and subduction of one plate.
+		NOISE_STREAM ///< Fractal noise added after last cycle.
+	};
+
+	/**
+	 * Seed an independent random number generator.
+	 *
+	 * Streams are keyed by simulation's seed, current cycle, the part of
+	 * simulation and an index within it, so their contents don't depend
+	 * on the order in which they are used.
+	 *
+	 * @param stream Part of the simulation that uses the numbers.
+	 * @param index Index of the user within the part, e.g. plate.
+	 * @return Seed for the generator.
+	 */
+	uint32_t getStreamSeed(randomStream stream, size_t index) const throw();
+
 	float* hmap; ///< Height map representing the topography of system.
-	size_t* imap; ///< Plate index map of the "owner" of each map point.
+	uint16_t* imap; ///< Plate index map of the "owner" of each map point.
+	uint16_t* prev_imap; ///< Index map of previous iteration (back buf).
+	uint32_t* amap; ///< Age map (creation timestamps) of crust.
 	plate** plates; ///< Array of plates that constitute the system.
 
 	size_t aggr_overlap_abs; ///< # of overlapping pixels -> aggregation.
 	float  aggr_overlap_rel; ///< % of overlapping area -> aggregation.
 	size_t cycle_count; ///< Number of times the system's been restarted.
+	size_t extension_count; ///< Growths of plates of earlier cycles.
 	size_t erosion_period; ///< # of iterations between global erosion.
 	float  folding_ratio; ///< Percent of overlapping crust that's folded.
 	size_t iter_count; ///< Iteration count. Used to timestamp new crust.
-	size_t map_side; ///< Length of square height map's side in pixels.
+	size_t map_width; ///< Height map's width in pixels.
+	size_t map_height; ///< Height map's height in pixels.
 	size_t max_cycles; ///< Max n:o of times the system'll be restarted.
 	size_t num_plates; ///< Number of plates in the current setting.
+	partitionMethod partition; ///< How createPlates() divides the world.
+	uint32_t seed; ///< Seed of all random numbers.
 
 	std::vector<std::vector<plateCollision> > collisions;
 	std::vector<std::vector<plateCollision> > subductions;
+	std::vector<std::vector<plateOverlap> > overlaps; ///< One per tile.
+	std::vector<double> erosion_time; ///< Seconds eroded, per plate index.
 
 	float peak_Ek; ///< Max total kinetic energy in the system so far.
 	size_t last_coll_count; ///< Iterations since last cont. collision.
@@ -1,9 +1,11 @@
 #include "generate.h"
 #include "optionparser.h"
+#include "parallel.h"
 
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <ctime>
 using namespace std;
 
 // optionparser extensions
@@ -44,15 +46,26 @@ struct Arg : public option::Arg
 
 // options accepted by program
 enum optionIndex {
-    UNKNOWN, HELP, SIZE, PADDING, PT_SCALEH, PT_SCALEV
+    UNKNOWN, HELP, GENERATOR, SIZE, PADDING, PT_SCALEH, PT_SCALEV, INTERPOLATION, THREADS,
+    VORONOI, SEED, COMPRESSION, LEVEL, UPDATE, BENCHMARK, PT_BENCHMARK
 };
 const option::Descriptor usage[] = {
 { UNKNOWN, 0,"","",        Arg::Unknown, "USAGE:\n   divinitas [options] world_name\n\nOptions:" },
 { HELP,    0,"h","help",   Arg::None,    "  -h, \t--help  \tPrint usage and exit." },
+{ GENERATOR,0,"","generator",Arg::Required,"   \t--generator=<platec|boxes>  \tPlate tectonics, or a flat test world of stone and copied boxes (default platec)." },
 { SIZE,    0,"s","size",   Arg::Numeric, "  -s <num>, \t--size=<num>  \tSize of world in chunks." },
 { PADDING, 0,"p","padding",Arg::Numeric, "  -p <num>, \t--padding=<num>  \tWidth of border of empty chunks around world (default 0)." },
 { PT_SCALEH,0,"","ptscaleh",Arg::Numeric,"   \t--ptscaleh=<num>  \tPlaTec horizontal scale (default 2)." },
 { PT_SCALEV,0,"","ptscalev",Arg::Numeric,"   \t--ptscalev=<num>  \tPlaTec vertical scale (default 4)." },
+{ INTERPOLATION,0,"","interpolation",Arg::Required,"   \t--interpolation=<bilinear|bicubic>  \tHow the PlaTec heightmap is scaled up to blocks (default bilinear)." },
+{ THREADS, 0,"","threads", Arg::Numeric, "   \t--threads=<num>  \tNumber of worker threads (default 0: all cores)." },
+{ VORONOI, 0,"","voronoi", Arg::None,    "   \t--voronoi  \tSplit crust into noisy Voronoi cells instead of growing plates." },
+{ SEED,    0,"","seed",    Arg::Numeric, "   \t--seed=<num>  \tSeed of random numbers (default: current time)." },
+{ COMPRESSION,0,"","compression",Arg::Required,"   \t--compression=<zlib|rle|fast>  \tChunk compression: zlib, zlib with run-length matches only, or fast deflate for previews (default zlib)." },
+{ LEVEL,   0,"","level",   Arg::Numeric, "   \t--level=<num>  \tzlib compression level, 1 (fastest) to 9 (smallest) (default 6)." },
+{ UPDATE,  0,"","update",  Arg::None,    "   \t--update  \tUpdate an existing world, rewriting only regions that changed since it was exported." },
+{ BENCHMARK,0,"","benchmark",Arg::None,  "   \t--benchmark  \tGenerate, then measure chunk compression methods instead of exporting." },
+{ PT_BENCHMARK,0,"","ptbenchmark",Arg::Numeric,"   \t--ptbenchmark=<num>  \tTime PlaTec steps on a map of that side (e.g. 2048 or 4096) and print peak memory, then exit." },
 /*
 { OPTIONAL,0,"o","optional",Arg::Optional,"  -o[<arg>], \t--optional[=<arg>]"
                                           "  \tTakes an argument but is happy without one." },
@@ -76,17 +89,28 @@ int main(int argc, char* argv[])
         return 1;
 
     // show help/usage
-    if (options[HELP] || argc == 0 || parse.nonOptionsCount() < 1) {
+    if (options[HELP] || argc == 0 ||
+            (parse.nonOptionsCount() < 1 && !options[BENCHMARK] &&
+             !options[PT_BENCHMARK])) {
         option::printUsage(cout, usage);
         return 0;
     }
 
     // parameters
-    const char* name = parse.nonOption(0);
+    const char* name = parse.nonOptionsCount() ? parse.nonOption(0) : "";
+    GeneratorType type = PLATEC;
     int size = 64;
     int padding = 0;
     int pt_scaleh = 2;
     int pt_scalev = 4;
+    Interpolation interpolation = BILINEAR;
+    int threads = 0;
+    bool voronoi = false;
+    unsigned int seed = (unsigned int)time(0);
+    CompressionOptions compression;
+    bool update = false;
+    bool benchmark = false;
+    int pt_benchmark = 0;
 
     for (int i = 0; i < parse.optionsCount(); ++i) {
         option::Option& opt = buffer[i];
@@ -99,6 +123,16 @@ int main(int argc, char* argv[])
                 cout <<"--optional without the optional argument\n";
             break;
         */
+        case GENERATOR:
+            if (string(opt.arg) == "platec") {
+                type = PLATEC;
+            } else if (string(opt.arg) == "boxes") {
+                type = BOXES;
+            } else {
+                cerr << "error: unknown generator: " << opt.arg << "\n";
+                return 1;
+            }
+            break;
         case SIZE:
             size = strtol(opt.arg, NULL, 10);
             break;
@@ -111,6 +145,53 @@ int main(int argc, char* argv[])
         case PT_SCALEV:
             pt_scalev = strtol(opt.arg, NULL, 10);
             break;
+        case INTERPOLATION:
+            if (string(opt.arg) == "bilinear") {
+                interpolation = BILINEAR;
+            } else if (string(opt.arg) == "bicubic") {
+                interpolation = BICUBIC;
+            } else {
+                cerr << "error: unknown interpolation: " << opt.arg << "\n";
+                return 1;
+            }
+            break;
+        case THREADS:
+            threads = strtol(opt.arg, NULL, 10);
+            break;
+        case VORONOI:
+            voronoi = true;
+            break;
+        case SEED:
+            seed = strtoul(opt.arg, NULL, 10);
+            break;
+        case COMPRESSION:
+            if (string(opt.arg) == "zlib") {
+                compression.method = ZLIB;
+            } else if (string(opt.arg) == "rle") {
+                compression.method = ZLIB_RLE;
+            } else if (string(opt.arg) == "fast") {
+                compression.method = FAST_DEFLATE;
+            } else {
+                cerr << "error: unknown compression method: " << opt.arg << "\n";
+                return 1;
+            }
+            break;
+        case LEVEL:
+            compression.level = strtol(opt.arg, NULL, 10);
+            if (compression.level < 1 || compression.level > 9) {
+                cerr << "error: compression level must be 1 to 9\n";
+                return 1;
+            }
+            break;
+        case UPDATE:
+            update = true;
+            break;
+        case BENCHMARK:
+            benchmark = true;
+            break;
+        case PT_BENCHMARK:
+            pt_benchmark = strtol(opt.arg, NULL, 10);
+            break;
 
         case HELP:
             // not possible, because handled further above and exits the program
@@ -126,7 +207,17 @@ int main(int argc, char* argv[])
         cout <<"Non-option argument #"<<i<<" is "<<parse.nonOption(i)<<"\n";
     */
 
-    switch (generateWorld(name, size, padding, pt_scaleh, pt_scalev)) {
+    parallel_set_threads(threads);
+
+    if (pt_benchmark > 0) {
+        benchmarkPlatec(pt_benchmark, voronoi, seed);
+        delete[] options;
+        delete[] buffer;
+        return 0;
+    }
+
+    switch (generateWorld(name, type, size, padding, pt_scaleh, pt_scalev, voronoi,
+            seed, interpolation, compression, update, benchmark)) {
     case ERR::NONE:
         break;
     case ERR::PATH_EXISTS:
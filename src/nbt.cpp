@@ -2,6 +2,7 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <zlib.h>
 using namespace std;
 
 uint8_t* allocate_byte_array(int32_t length) { return (uint8_t*)malloc(length); }
@@ -119,3 +120,87 @@ nbt_node *tag_int_array_allocated(const char *name, int32_t length, int32_t* dat
     return node;
 }
 
+
+
+// big endian stores
+static inline void put16(uint8_t *p, uint16_t n) { p[0] = n >> 8; p[1] = n; }
+static inline void put32(uint8_t *p, uint32_t n) { n = __builtin_bswap32(n); memcpy(p, &n, 4); }
+static inline void put64(uint8_t *p, uint64_t n) { n = __builtin_bswap64(n); memcpy(p, &n, 8); }
+
+uint8_t *NBTWriter::grow(size_t n) {
+    size_t old = data.size();
+    data.resize(old + n);
+    return &data[old];
+}
+
+void NBTWriter::header(nbt_type type, const char *name) {
+    size_t len = strlen(name);
+    uint8_t *p = grow(3 + len);
+    p[0] = type;
+    put16(p + 1, len);
+    memcpy(p + 3, name, len);
+}
+
+void NBTWriter::beginCompound(const char *name) { header(TAG_COMPOUND, name); }
+void NBTWriter::endCompound() { *grow(1) = 0; } // TAG_End
+
+void NBTWriter::beginList(const char *name, nbt_type type, int32_t length) {
+    header(TAG_LIST, name);
+    uint8_t *p = grow(5);
+    p[0] = type;
+    put32(p + 1, length);
+}
+
+void NBTWriter::tagByte(const char *name, int8_t n) {
+    header(TAG_BYTE, name);
+    *grow(1) = n;
+}
+void NBTWriter::tagInt(const char *name, int32_t n) {
+    header(TAG_INT, name);
+    put32(grow(4), n);
+}
+void NBTWriter::tagLong(const char *name, int64_t n) {
+    header(TAG_LONG, name);
+    put64(grow(8), n);
+}
+
+uint8_t *NBTWriter::tagByteArray(const char *name, int32_t length) {
+    header(TAG_BYTE_ARRAY, name);
+    uint8_t *p = grow(4 + length);
+    put32(p, length);
+    return p + 4;
+}
+void NBTWriter::tagIntArray(const char *name, int32_t length, const int32_t *values) {
+    header(TAG_INT_ARRAY, name);
+    uint8_t *p = grow(4 + 4 * length);
+    put32(p, length);
+    for (int32_t i = 0; i < length; i++)
+        put32(p + 4 + 4 * i, values[i]);
+}
+
+buffer compress_zlib(const uint8_t *data, size_t len, int level, int strategy,
+        int windowBits, int flush) {
+    buffer b = { NULL, 0, 0 };
+    z_stream stream;
+    memset(&stream, 0, sizeof stream);
+    if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, strategy) != Z_OK)
+        return b;
+
+    b.cap = deflateBound(&stream, len) + 6; // and an empty block to flush
+    b.data = (unsigned char*)malloc(b.cap);
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = len;
+    stream.next_out = b.data;
+    stream.avail_out = b.cap;
+    const int done = flush == Z_FINISH ? Z_STREAM_END : Z_OK;
+    if (b.data && deflate(&stream, flush) == done && stream.avail_in == 0 &&
+            stream.avail_out > 0) {
+        b.len = stream.total_out;
+    } else {
+        free(b.data);
+        b.data = NULL;
+        b.cap = 0;
+    }
+    deflateEnd(&stream);
+    return b;
+}
@@ -8,6 +8,7 @@
 
 #include <nbt/nbt.h> // cNBT
 #include <vector>
+#include <zlib.h>
 //#include <cstdint>
 
 /* list builder class for passing multiple args conveniently.
@@ -52,5 +53,48 @@ nbt_node *tag_list(const char *name, NBTList entries);
 nbt_node *tag_compound(const char *name, NBTList entries);
 
 
+/* writes NBT straight into a byte buffer, without building a tree of
+ * nbt_nodes first. the output is the same as nbt_dump_binary() of the
+ * equivalent tree. the buffer is kept between uses, so a reused writer
+ * stops allocating once it has grown large enough.
+ *
+ * nesting isn't checked: end every compound with endCompound(), and put
+ * exactly 'length' unnamed payloads into every list. a compound payload
+ * in a list is its named tags followed by endCompound().
+ */
+struct NBTWriter {
+    std::vector<uint8_t> data;
+
+    void clear() { data.clear(); }
+    // make room for 'n' more bytes, so that pointers returned by
+    // tagByteArray() stay valid until that much has been written
+    void reserve(size_t n) { data.reserve(data.size() + n); }
+
+    void beginCompound(const char *name);
+    void endCompound();
+    void beginList(const char *name, nbt_type type, int32_t length);
+
+    void tagByte(const char *name, int8_t);
+    void tagInt(const char *name, int32_t);
+    void tagLong(const char *name, int64_t);
+    // returns space for the array's contents, valid until the buffer grows
+    uint8_t *tagByteArray(const char *name, int32_t length);
+    void tagIntArray(const char *name, int32_t length, const int32_t *values);
+
+private:
+    uint8_t *grow(size_t n);
+    void header(nbt_type type, const char *name);
+};
+
+// zlib compress 'len' bytes. with the default level and strategy this is
+// the same as nbt_dump_compressed() with STRAT_INFLATE. 'windowBits' as in
+// deflateInit2(), -15 gives a bare deflate stream. 'flush' Z_SYNC_FLUSH
+// instead of Z_FINISH leaves the stream open for more data. free the
+// result's data with free().
+buffer compress_zlib(const uint8_t *data, size_t len,
+        int level = Z_DEFAULT_COMPRESSION, int strategy = Z_DEFAULT_STRATEGY,
+        int windowBits = 15, int flush = Z_FINISH);
+
+
 #endif
 
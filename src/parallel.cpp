@@ -0,0 +1,182 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Persistent pool of worker threads.
+ *
+ * Only one job runs at a time. The thread that submits a job takes part in
+ * processing it, so a pool of N threads owns N - 1 worker threads.
+ */
+class workerPool
+{
+  public:
+
+	workerPool() throw() : num_threads(defaultThreads()), task(0), ctx(0),
+		count(0), next(0), busy(0), generation(0), quit(false) {}
+
+	~workerPool() throw() { stop(); }
+
+	int getThreads() const throw() { return num_threads; }
+
+	void setThreads(int n) throw()
+	{
+		lock_guard<mutex> guard(run_lock);
+		stop();
+		num_threads = n > 0 ? n : defaultThreads();
+	}
+
+	void run(int n, parallel_task t, void* c) throw()
+	{
+		if (n <= 0)
+			return;
+
+		// Nested loops and single item jobs aren't worth the trouble.
+		if (inside || n == 1)
+		{
+			for (int i = 0; i < n; ++i)
+				t(c, i);
+			return;
+		}
+
+		lock_guard<mutex> guard(run_lock);
+
+		if (num_threads < 2)
+		{
+			inside = true;
+			for (int i = 0; i < n; ++i)
+				t(c, i);
+			inside = false;
+			return;
+		}
+
+		if (workers.empty())
+			start();
+
+		{
+			lock_guard<mutex> lk(lock);
+			task = t;
+			ctx = c;
+			count = n;
+			next = 0;
+			++generation;
+		}
+		wake.notify_all();
+
+		inside = true;
+		for (int i; (i = next.fetch_add(1)) < n; )
+			t(c, i);
+		inside = false;
+
+		// Detach the job so that late workers won't pick it up and wait
+		// for those that already did to finish their last items.
+		unique_lock<mutex> lk(lock);
+		task = 0;
+		idle.wait(lk, [this] { return busy == 0; });
+	}
+
+  protected:
+  private:
+
+	static int defaultThreads() throw()
+	{
+		const int n = thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	void start() throw()
+	{
+		quit = false;
+		for (int i = 1; i < num_threads; ++i)
+			workers.push_back(thread(&workerPool::work, this));
+	}
+
+	void stop() throw()
+	{
+		{
+			lock_guard<mutex> lk(lock);
+			quit = true;
+		}
+		wake.notify_all();
+
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+
+		workers.clear();
+	}
+
+	void work() throw()
+	{
+		unsigned long seen = 0;
+		unique_lock<mutex> lk(lock);
+
+		inside = true;
+		for (;;)
+		{
+			wake.wait(lk, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+
+			seen = generation;
+			if (!task)
+				continue; // Job was completed without our help.
+
+			const parallel_task t = task;
+			void* const c = ctx;
+			const int n = count;
+
+			++busy;
+			lk.unlock();
+
+			for (int i; (i = next.fetch_add(1)) < n; )
+				t(c, i);
+
+			lk.lock();
+			if (--busy == 0)
+				idle.notify_all();
+		}
+	}
+
+	atomic<int> num_threads; ///< Thread count incl. the submitting one.
+	vector<thread> workers; ///< Worker threads, created on first job.
+
+	mutex run_lock; ///< Serializes jobs and pool reconfiguration.
+	mutex lock; ///< Protects the job description below.
+	condition_variable wake; ///< Signaled when a new job is published.
+	condition_variable idle; ///< Signaled when last worker leaves a job.
+
+	parallel_task task; ///< Work item callback of current job, or 0.
+	void* ctx; ///< Context pointer of current job.
+	int count; ///< Number of work items in current job.
+	atomic<int> next; ///< Index of the next unclaimed work item.
+	int busy; ///< Number of workers processing current job.
+	unsigned long generation; ///< Incremented for every published job.
+	bool quit; ///< Tells workers to exit.
+
+	static thread_local bool inside; ///< True within a running work item.
+};
+
+thread_local bool workerPool::inside = false;
+
+static workerPool pool;
+
+extern "C" void parallel_set_threads(int num_threads)
+{
+	pool.setThreads(num_threads);
+}
+
+extern "C" int parallel_get_threads(void)
+{
+	return pool.getThreads();
+}
+
+extern "C" void parallel_run(int count, parallel_task task, void* ctx)
+{
+	pool.run(count, task, ctx);
+}
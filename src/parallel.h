@@ -0,0 +1,71 @@
+/** @file parallel.h
+ *  @brief Small worker pool shared by the simulation and the exporter.
+ *
+ *  The pool is created lazily on first use and is reused for the rest of
+ *  the process' life, so issuing many short parallel loops is cheap. The
+ *  interface is plain C so that C sources can use it too.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief Work item callback of parallel_run().
+ *
+ *  @param	ctx Caller supplied context pointer.
+ *  @param	index Index of the work item in range [0, count[.
+ */
+typedef void (*parallel_task)(void* ctx, int index);
+
+/**
+ *  @brief Set the number of threads used by parallel_run().
+ *
+ *  The calling thread counts as one of the threads.
+ *
+ *  @param	num_threads Thread count or zero to use all available cores.
+ */
+extern void parallel_set_threads(int num_threads);
+
+/**
+ *  @brief Get the number of threads used by parallel_run().
+ *
+ *  @return	Number of threads, always at least one.
+ */
+extern int parallel_get_threads(void);
+
+/**
+ *  @brief Run work items [0, count[ on the worker pool.
+ *
+ *  Items are handed out in increasing order but they may complete in any
+ *  order. Function returns when all of them are done. Calls made from
+ *  within a running work item are executed serially on the calling thread.
+ *
+ *  @param	count Number of work items.
+ *  @param	task Function to call for every work item.
+ *  @param	ctx Context pointer passed to the task as is.
+ */
+extern void parallel_run(int count, parallel_task task, void* ctx);
+
+#ifdef	__cplusplus
+}
+
+template <typename F>
+static void parallel_trampoline(void* ctx, int index)
+{
+	(*(F*)ctx)(index);
+}
+
+/**
+ *  @brief Convenience wrapper of parallel_run() for lambdas and functors.
+ */
+template <typename F>
+inline void parallel_for(int count, F f)
+{
+	parallel_run(count, &parallel_trampoline<F>, &f);
+}
+#endif
+
+#endif
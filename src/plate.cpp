@@ -1,7 +1,9 @@
 
+#include <algorithm> // fill_n
 #include <cfloat> // FT_EPSILON
 #include <cmath> // sin, cos
-#include <cstdlib> // rand
+#include <cstddef> // ptrdiff_t
+#include <cstdlib>
 #include <cstdio> // DEBUG print
 
 #include "plate.hpp"
@@ -12,6 +14,27 @@
 
 #define INITIAL_SPEED_X 1
 #define DEFORMATION_WEIGHT 5
+
+/// Segment ID of crust that belongs to no segment (yet).
+static const uint32_t NO_SEGMENT = 0xFFFFFFFF;
+
+/// Growing plate is extended by at least its size divided by this.
+static const size_t GROWTH_DIVISOR = 4;
+
+/// Wrap a coordinate around a world edge into range [0, side[.
+///
+/// Coordinates are at most a few sides off. Those below zero come wrapped
+/// around size_t, like the results of unsigned subtractions do.
+static inline size_t wrapCoordinate(size_t x, size_t side)
+{
+	ptrdiff_t v = (ptrdiff_t)x;
+	while (v < 0)
+		v += side;
+	while (v >= (ptrdiff_t)side)
+		v -= side;
+
+	return v;
+}
 /*
 // http://en.wikipedia.org/wiki/Methods_of_computing_square_roots
 static float invSqrt(float x)
@@ -31,26 +54,33 @@ static float fastSqrt(float x)
 }
 */
 plate::plate(const float* m, size_t w, size_t h, size_t _x, size_t _y,
-             size_t plate_age, size_t _world_side) throw() :
-             width(w), height(h), world_side(_world_side),
-             mass(0), left(_x), top(_y), cx(0), cy(0), dx(0), dy(0)
+             size_t plate_age, size_t world_w, size_t world_h, uint32_t seed)
+             throw() :
+             width(w), height(h), world_width(world_w), world_height(world_h),
+             extensions(0),
+             mass(0), left(_x), top(_y), cx(0), cy(0), dx(0), dy(0),
+             rng(seed)
 {
 	const size_t A = w * h; // A as in Area.
-	const double angle = 2 * M_PI * rand() / (double)RAND_MAX;
+	const double angle = 2 * M_PI * rng.rand();
 	size_t i, j, k;
 
 	if (!m)
 		return;
 
 	map = new float[A];
-	age = new size_t[A];
-	segment = new size_t[A];
+	age = new uint32_t[A];
+	segment = new uint32_t[A];
+	row_x0 = new uint32_t[h];
+	row_x1 = new uint32_t[h];
+	memset(row_x0, 0, h * sizeof(uint32_t));
+	memset(row_x1, 0, h * sizeof(uint32_t));
 
 	velocity = 1;
-	alpha = -(rand() & 1) * M_PI * 0.01 * (rand() / (float)RAND_MAX);
+	alpha = -(int)(rng.randInt() & 1) * M_PI * 0.01 * rng.rand();
 	vx = cos(angle) * INITIAL_SPEED_X;
 	vy = sin(angle) * INITIAL_SPEED_X;
-	memset(segment, 255, A * sizeof(size_t));
+	std::fill_n(segment, A, NO_SEGMENT);
 
 	for (j = k = 0; j < height; ++j)
 		for (i = 0; i < width; ++i, ++k)
@@ -73,6 +103,8 @@ plate::plate(const float* m, size_t w, size_t h, size_t _x, size_t _y,
 	// Normalize center of mass coordinates.
 	cx /= mass;
 	cy /= mass;
+
+	updateRowExtents(0, height);
 }
 
 plate::~plate() throw()
@@ -80,6 +112,8 @@ plate::~plate() throw()
 	delete[] map; map = 0;
 	delete[] age; age = 0;
 	delete[] segment; segment = 0;
+	delete[] row_x0; row_x0 = 0;
+	delete[] row_x1; row_x1 = 0;
 }
 
 size_t plate::addCollision(size_t wx, size_t wy) throw()
@@ -176,16 +210,16 @@ void plate::addCrustBySubduction(size_t x, size_t y, float z, size_t t,
 	dx -= this->vx * (dot > 0);
 	dy -= this->vy * (dot > 0);
 
-	float offset = (float)rand() / (float)RAND_MAX;
-	offset *= offset * offset * (2 * (rand() & 1) - 1);
+	float offset = (float)rng.rand();
+	offset *= offset * offset * (2 * (int)(rng.randInt() & 1) - 1);
 	dx = 10 * dx + 3 * offset;
 	dy = 10 * dx + 3 * offset;
 
-	x = (size_t)((int)x + dx);
-	y = (size_t)((int)y + dy);
+	x = (size_t)(ptrdiff_t)((int)x + dx);
+	y = (size_t)(ptrdiff_t)((int)y + dy);
 
-	if (width == world_side) x &= width - 1;
-	if (height == world_side) y &= height - 1;
+	if (width == world_width) x = wrapCoordinate(x, width);
+	if (height == world_height) y = wrapCoordinate(y, height);
 
 	index = y * width + x;
 	if (index < width * height && map[index] > 0)
@@ -243,8 +277,8 @@ float plate::aggregateCrust(plate* p, size_t wx, size_t wy) throw()
 	p->selectCollisionSegment(wx, wy);
 
 	// Wrap coordinates around world edges to safeguard subtractions.
-	wx += world_side;
-	wy += world_side;
+	wx += world_width;
+	wy += world_height;
 
 //	printf("Aggregating segment [%u, %u]x[%u, %u] vs. [%u, %u]@[%u, %u]\n",
 //		seg_data[seg_id].x0, seg_data[seg_id].y0,
@@ -409,7 +443,238 @@ void plate::collide(plate& p, size_t wx, size_t wy, float coll_mass) throw()
 	// path upwards like it should. Seems correct right?
 }
 
+/// Crust that erosion moves from a point, one row of values per kind.
+enum
+{
+	TO_W1, TO_W2, ///< First and second amount added to west neighbour.
+	TO_E1, TO_E2, ///< First and second amount added to east neighbour.
+	TO_N1, TO_N2, ///< First and second amount added to north neighbour.
+	TO_S1, TO_S2, ///< First and second amount added to south neighbour.
+	DROP, ///< Amount removed from the point itself.
+	SPREAD, ///< Amount returned to the point itself.
+	NUM_SHARES
+};
+
+/// Amount of crust that leaves a point of height map in erosion.
+///
+/// Does the same arithmetic as plate::erodeWrapping(). Masking products
+/// are written as selects, which give the same results save for the sign
+/// of zero terms but let the compiler vectorize loops calling this.
+///
+/// @param	h	Height of the point.
+/// @param	w	Height of west neighbour.
+/// @param	e	Height of east neighbour.
+/// @param	n	Height of north neighbour.
+/// @param	s	Height of south neighbour.
+/// @param	lower_bound Limit below which there's no erosion.
+/// @param[out]	lo	Point's height drop to its tallest lower neighbour.
+/// @param[out]	k	Scale of the first share to neighbours.
+/// @param[out]	m	Equal share of the remaining crust.
+static inline void erosionDrop(float h, float w, float e, float n, float s,
+	float lower_bound, float* lo, float* k, float* m) throw()
+{
+	const float w_crust = w < h ? w : 0;
+	const float e_crust = e < h ? e : 0;
+	const float n_crust = n < h ? n : 0;
+	const float s_crust = s < h ? s : 0;
+
+	const float w_diff = h - w_crust;
+	const float e_diff = h - e_crust;
+	const float n_diff = h - n_crust;
+	const float s_diff = h - s_crust;
+
+	float min_diff = w_diff;
+	min_diff = e_diff < min_diff ? min_diff - (min_diff - e_diff) : min_diff;
+	min_diff = n_diff < min_diff ? min_diff - (min_diff - n_diff) : min_diff;
+	min_diff = s_diff < min_diff ? min_diff - (min_diff - s_diff) : min_diff;
+
+	const float diff_sum = (w_crust > 0 ? w_diff - min_diff : 0) +
+	                       (e_crust > 0 ? e_diff - min_diff : 0) +
+	                       (n_crust > 0 ? n_diff - min_diff : 0) +
+	                       (s_crust > 0 ? s_diff - min_diff : 0);
+
+	const float spread = (min_diff - diff_sum) / (1 + (w_crust > 0) +
+		(e_crust > 0) + (n_crust > 0) + (s_crust > 0));
+	const float unit = min_diff / diff_sum;
+
+	// Either point is too low, it has no lower neighbours or it's the
+	// lowest part of its area. In any case no crust leaves it.
+	const bool erodes = !(h < lower_bound) &
+		!(w_crust + e_crust + n_crust + s_crust == 0);
+	const bool fills = diff_sum < min_diff;
+
+	*lo = erodes ? min_diff : 0;
+	*k = erodes ? (fills ? 1 : unit) : 0;
+	*m = erodes & fills ? spread : 0;
+}
+
+/// Share of crust that a point erodes onto one of its neighbours.
+///
+/// @param	src	Height of the eroding point.
+/// @param	dst	Height of the neighbour.
+/// @param	lo	Point's height drop to its tallest lower neighbour.
+/// @param	k	Scale of the first share (0 if point doesn't erode).
+/// @param	m	Point's equal share of the remaining crust.
+/// @param[out]	first	First amount added to neighbour.
+/// @param[out]	second	Second amount added to neighbour.
+static inline void erosionShare(float src, float dst, float lo, float k,
+	float m, float* first, float* second) throw()
+{
+	const float crust = dst < src ? dst : 0;
+
+	*first = crust > 0 ? k * ((src - crust) - lo) : 0;
+	*second = crust > 0 ? m : 0;
+}
+
+/// Calculate the crust that each point of a row sends to its neighbours.
+///
+/// @param	c	Heights of the row within a bordered copy of height map.
+/// @param	pw	Length of a row in the bordered map, border included.
+/// @param	lower_bound Limit below which there's no erosion.
+/// @param[out]	share	NUM_SHARES rows of pw values each.
+static void erosionScatterRow(const float* c, size_t pw, float lower_bound,
+	float* share) throw()
+{
+	#pragma omp simd
+	for (size_t x = 1; x < pw - 1; ++x)
+	{
+		float lo, k, m;
+
+		erosionDrop(c[x], c[x - 1], c[x + 1], c[x - pw], c[x + pw],
+			lower_bound, &lo, &k, &m);
+
+		erosionShare(c[x], c[x - 1], lo, k, m,
+			share + TO_W1 * pw + x, share + TO_W2 * pw + x);
+		erosionShare(c[x], c[x + 1], lo, k, m,
+			share + TO_E1 * pw + x, share + TO_E2 * pw + x);
+		erosionShare(c[x], c[x - pw], lo, k, m,
+			share + TO_N1 * pw + x, share + TO_N2 * pw + x);
+		erosionShare(c[x], c[x + pw], lo, k, m,
+			share + TO_S1 * pw + x, share + TO_S2 * pw + x);
+
+		share[DROP * pw + x] = lo;
+		share[SPREAD * pw + x] = m;
+	}
+
+	// Border doesn't take part in erosion.
+	for (size_t i = 0; i < NUM_SHARES; ++i)
+		share[i * pw] = share[i * pw + pw - 1] = 0;
+}
+
+/// Sum the crust that each point of a row ends up with after erosion.
+///
+/// Amounts are added in the order plate::erodeWrapping() would have added
+/// them by visiting the north, west, the point itself, east and south.
+///
+/// @param	c	Heights of the row within a bordered copy of height map.
+/// @param	pw	Length of a row in the bordered map, border included.
+/// @param	up	Shares sent by the row above.
+/// @param	share	Shares sent by this row.
+/// @param	down	Shares sent by the row below.
+/// @param[out]	out	New heights of the row, without border.
+static void erosionGatherRow(const float* c, size_t pw, const float* up,
+	const float* share, const float* down, float* out) throw()
+{
+	#pragma omp simd
+	for (size_t x = 1; x < pw - 1; ++x)
+	{
+		float sum = 0;
+
+		sum += up[TO_S1 * pw + x];
+		sum += up[TO_S2 * pw + x];
+		sum += share[TO_E1 * pw + x - 1];
+		sum += share[TO_E2 * pw + x - 1];
+		sum += c[x];
+		sum -= share[DROP * pw + x];
+		sum += share[SPREAD * pw + x];
+		sum += share[TO_W1 * pw + x + 1];
+		sum += share[TO_W2 * pw + x + 1];
+		sum += down[TO_N1 * pw + x];
+		sum += down[TO_N2 * pw + x];
+
+		out[x - 1] = sum;
+	}
+}
+
 void plate::erode(float lower_bound) throw()
+{
+  // Plates that span the whole world wrap around its edges, which breaks
+  // the visiting order the gather below relies on. They are rare.
+  if (width == world_width || height == world_height)
+  {
+    erodeWrapping(lower_bound);
+    updateRowExtents(0, height);
+    return;
+  }
+
+  // Work on copy of the height map with a border of one point around it.
+  // Border is never lower than its neighbour and it doesn't erode, which
+  // makes the loops below free of edge cases.
+  const size_t pw = width + 2;
+  const size_t pa = pw * (height + 2);
+  const size_t slot = NUM_SHARES * pw;
+  float* tmp = new float[width * height];
+  float* h = new float[pa];
+
+  // Crust shares are only needed for the row being gathered and the rows
+  // next to it. Row y of the bordered map uses slot y % 3.
+  float* share = new float[3 * slot];
+
+  std::fill_n(h, pw, FLT_MAX);
+  std::fill_n(h + pa - pw, pw, FLT_MAX);
+
+  mass = 0;
+  cx = cy = 0;
+
+  for (size_t y = 0, index = 0; y < height; ++y)
+  {
+    float* const row = h + (y + 1) * pw;
+
+    row[0] = row[width + 1] = FLT_MAX;
+    memcpy(row + 1, map + y * width, width * sizeof(float));
+
+    for (size_t x = 0; x < width; ++x, ++index)
+    {
+	mass += map[index];
+
+	// Update the center coordinates weighted by mass.
+	cx += x * map[index];
+	cy += y * map[index];
+    }
+  }
+
+  std::fill_n(share, slot, 0.0f);
+  erosionScatterRow(h + pw, pw, lower_bound, share + slot);
+
+  for (size_t y = 1; y <= height; ++y)
+  {
+    float* const down = share + (y + 1) % 3 * slot;
+
+    if (y < height)
+	erosionScatterRow(h + (y + 1) * pw, pw, lower_bound, down);
+    else
+	std::fill_n(down, slot, 0.0f);
+
+    erosionGatherRow(h + y * pw, pw, share + (y - 1) % 3 * slot,
+	share + y % 3 * slot, down, tmp + (y - 1) * width);
+  }
+
+  delete[] share;
+  delete[] h;
+  delete[] map;
+  map = tmp;
+
+  if (mass > 0)
+  {
+    cx /= mass;
+    cy /= mass;
+  }
+
+  // Eroded crust may have flown onto empty points next to it.
+  updateRowExtents(0, height);
+}
+
+void plate::erodeWrapping(float lower_bound) throw()
 {
   float* tmp = new float[width*height];
 
@@ -433,18 +698,18 @@ void plate::erode(float lower_bound) throw()
 
 	// Build masks for accessible directions (4-way).
 	// Allow wrapping around map edges if plate has world wide dimensions.
-	size_t w_mask = -((x > 0) | (width == world_side));
-	size_t e_mask = -((x < width - 1) | (width == world_side));
-	size_t n_mask = -((y > 0) | (height == world_side));
-	size_t s_mask = -((y < height - 1) | (height == world_side));
+	size_t w_mask = -((x > 0) | (width == world_width));
+	size_t e_mask = -((x < width - 1) | (width == world_width));
+	size_t n_mask = -((y > 0) | (height == world_height));
+	size_t s_mask = -((y < height - 1) | (height == world_height));
 
 	// Calculate the x and y offset of neighbour directions.
 	// If neighbour is out of plate edges, set it to zero. This protects
 	// map memory reads from segment faulting.
-    	size_t w = (world_side + x - 1) & (world_side - 1) & w_mask;
-    	size_t e = (world_side + x + 1) & (world_side - 1) & e_mask;
-    	size_t n = (world_side + y - 1) & (world_side - 1) & n_mask;
-    	size_t s = (world_side + y + 1) & (world_side - 1) & s_mask;
+    	size_t w = (x > 0 ? x - 1 : world_width - 1) & w_mask;
+    	size_t e = (x + 1 < world_width ? x + 1 : 0) & e_mask;
+    	size_t n = (y > 0 ? y - 1 : world_height - 1) & n_mask;
+    	size_t s = (y + 1 < world_height ? y + 1 : 0) & s_mask;
 
 	// Calculate offsets within map memory.
 	w = y * width + w;
@@ -601,18 +866,25 @@ float plate::getCrust(size_t x, size_t y) const throw()
 	return index < (size_t)(-1) ? map[index] : 0;
 }
 
-size_t plate::getCrustTimestamp(size_t x, size_t y) const throw()
+uint32_t plate::getCrustTimestamp(size_t x, size_t y) const throw()
 {
 	const size_t index = getMapIndex(&x, &y);
 	return index < (size_t)(-1) ? age[index] : 0;
 }
 
-void plate::getMap(const float** c, const size_t** t) const throw()
+void plate::getMap(const float** c, const uint32_t** t) const throw()
 {
 	if (c) *c = map;
 	if (t) *t = age;
 }
 
+void plate::getRowExtents(const uint32_t** x0, const uint32_t** x1)
+	const throw()
+{
+	if (x0) *x0 = row_x0;
+	if (x1) *x1 = row_x1;
+}
+
 void plate::move() throw()
 {
 	float len;
@@ -641,11 +913,12 @@ void plate::move() throw()
 	vy = _vy;
 	#endif
 
-	// Location modulations into range [0, world_side[ are a have to!
+	// Location modulations into range [0, world_width[ and
+	// [0, world_height[ are a have to!
 	// If left undone SOMETHING WILL BREAK DOWN SOMEWHERE in the code!
 
 	#ifdef DEBUG
-	if (left < 0 || left > world_side || top < 0 || top > world_side)
+	if (left < 0 || left > world_width || top < 0 || top > world_height)
 	{
 		puts("Location coordinates out of world map bounds (PRE)!");
 		exit(1);
@@ -653,15 +926,15 @@ void plate::move() throw()
 	#endif
 
 	left += vx * velocity;
-	left += left > 0 ? 0 : world_side;
-	left -= left < world_side ? 0 : world_side;
+	left += left > 0 ? 0 : world_width;
+	left -= left < world_width ? 0 : world_width;
 
 	top += vy * velocity;
-	top += top > 0 ? 0 : world_side;
-	top -= top < world_side ? 0 : world_side;
+	top += top > 0 ? 0 : world_height;
+	top -= top < world_height ? 0 : world_height;
 
 	#ifdef DEBUG
-	if (left < 0 || left > world_side || top < 0 || top > world_side)
+	if (left < 0 || left > world_width || top < 0 || top > world_height)
 	{
 		puts("Location coordinates out of world map bounds (POST)!");
 		printf("%f, %f, %f; %f, %f\n", vx, vy, velocity, left, top);
@@ -670,10 +943,148 @@ void plate::move() throw()
 	#endif
 }
 
-void plate::resetSegments() throw()
+/// Find the root label of a provisional segment label.
+static uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t label)
+{
+	while (parent[label] != label)
+		label = parent[label] = parent[parent[label]];
+
+	return label;
+}
+
+/// Merge two provisional segment labels. The smaller one becomes the root.
+static void uniteRoots(std::vector<uint32_t>& parent, uint32_t a, uint32_t b)
 {
-	memset(segment, -1, sizeof(size_t) * width * height);
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+}
+
+void plate::findSegments() throw()
+{
+	std::vector<uint32_t> parent;
 	seg_data.clear();
+
+	// First pass: give each run of continental crust on a row a label
+	// and record which labels the runs above it connect it to. Points
+	// outside row extents have no crust and are never segmented.
+	for (size_t y = 0; y < height; ++y)
+	{
+		const float* const row = &map[y * width];
+		uint32_t* const seg = &segment[y * width];
+		const size_t x1 = row_x1[y];
+
+		for (size_t x = row_x0[y]; x < x1; )
+		{
+			if (row[x] < CONT_BASE)
+			{
+				seg[x++] = NO_SEGMENT;
+				continue;
+			}
+
+			size_t end = x + 1;
+			while (end < x1 && row[end] >= CONT_BASE)
+				++end;
+
+			uint32_t label = NO_SEGMENT;
+			if (y > 0)
+			{
+				const uint32_t* const above = seg - width;
+				uint32_t last = NO_SEGMENT;
+
+				for (size_t i = x; i < end; ++i)
+				  if (above[i] != NO_SEGMENT && above[i] != last)
+				  {
+					last = above[i];
+					if (label == NO_SEGMENT)
+						label = last;
+					else
+						uniteRoots(parent, label, last);
+				  }
+			}
+
+			if (label == NO_SEGMENT)
+			{
+				label = parent.size();
+				parent.push_back(label);
+			}
+
+			std::fill(seg + x, seg + end, label);
+			x = end;
+		}
+	}
+
+	// Continents of world wide plates continue across world edges.
+	if (width == world_width)
+		for (size_t i = 0; i < width * height; i += width)
+			if (segment[i] != NO_SEGMENT &&
+			    segment[i + width - 1] != NO_SEGMENT)
+				uniteRoots(parent, segment[i],
+					segment[i + width - 1]);
+
+	if (height == world_height)
+		for (size_t i = 0, j = (height - 1) * width; i < width;
+		     ++i, ++j)
+			if (segment[i] != NO_SEGMENT &&
+			    segment[j] != NO_SEGMENT)
+				uniteRoots(parent, segment[i], segment[j]);
+
+	// Labels only point to smaller ones, so a single sweep resolves them
+	// all. Segments get numbered in the order they are met on the map.
+	for (size_t i = 0; i < parent.size(); ++i)
+		if (parent[i] == i)
+		{
+			parent[i] = seg_data.size();
+			seg_data.push_back(segmentData(width, height, 0, 0, 0));
+		}
+		else
+			parent[i] = parent[parent[i]];
+
+	// Second pass: replace labels with segment IDs and gather the area
+	// and bounds of each segment.
+	for (size_t y = 0; y < height; ++y)
+	{
+		uint32_t* const seg = &segment[y * width];
+		const size_t x1 = row_x1[y];
+
+		for (size_t x = row_x0[y]; x < x1; )
+		{
+			const uint32_t label = seg[x];
+			if (label == NO_SEGMENT)
+			{
+				++x;
+				continue;
+			}
+
+			const size_t start = x;
+			const uint32_t id = parent[label];
+			for (; x < x1 && seg[x] == label; ++x)
+				seg[x] = id;
+
+			segmentData& data = seg_data[id];
+			data.area += x - start;
+			if (y < data.y0) data.y0 = y;
+			if (y > data.y1) data.y1 = y;
+			if (start < data.x0) data.x0 = start;
+			if (x - 1 > data.x1) data.x1 = x - 1;
+		}
+	}
+}
+
+size_t plate::growthSlack(size_t length, size_t growth,
+	size_t world_length) const throw()
+{
+	if (growth == 0 || length + growth >= world_length)
+		return 0;
+
+	// Keep to multiples of 8 and never fill the world by slack alone.
+	size_t slack = (length / GROWTH_DIVISOR) & ~(size_t)7;
+	const size_t room = world_length - length - growth;
+	return slack < room ? slack : room & ~(size_t)7;
 }
 
 void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
@@ -700,21 +1111,21 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 		const size_t irgt = ilft + width - 1;
 		const size_t ibtm = itop + height - 1;
 
-		x &= world_side - 1; // HACK!
-		y &= world_side - 1; // Just to be safe...
+		x = wrapCoordinate(x, world_width); // HACK!
+		y = wrapCoordinate(y, world_height); // Just to be safe...
 
 		// Calculate distance of new point from plate edges.
 		const size_t _lft = ilft - x;
-		const size_t _rgt = (world_side & -(x < ilft)) + x - irgt;
+		const size_t _rgt = (world_width & -(x < ilft)) + x - irgt;
 		const size_t _top = itop - y;
-		const size_t _btm = (world_side & -(y < itop)) + y - ibtm;
+		const size_t _btm = (world_height & -(y < itop)) + y - ibtm;
 
 		// Set larger of horizontal/vertical distance to zero.
 		// A valid distance is NEVER larger than world's side's length!
-		size_t d_lft = _lft & -(_lft <  _rgt) & -(_lft < world_side);
-		size_t d_rgt = _rgt & -(_rgt <= _lft) & -(_rgt < world_side);
-		size_t d_top = _top & -(_top <  _btm) & -(_top < world_side);
-		size_t d_btm = _btm & -(_btm <= _top) & -(_btm < world_side);
+		size_t d_lft = _lft & -(_lft <  _rgt) & -(_lft < world_width);
+		size_t d_rgt = _rgt & -(_rgt <= _lft) & -(_rgt < world_width);
+		size_t d_top = _top & -(_top <  _btm) & -(_top < world_height);
+		size_t d_btm = _btm & -(_btm <= _top) & -(_btm < world_height);
 
 		// Scale all changes to multiple of 8.
 		d_lft = ((d_lft > 0) + (d_lft >> 3)) << 3;
@@ -722,17 +1133,30 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 		d_top = ((d_top > 0) + (d_top >> 3)) << 3;
 		d_btm = ((d_btm > 0) + (d_btm >> 3)) << 3;
 
+		// Leave some slack to the side that grows. Crust is usually
+		// added next to the previous addition, e.g. when a continent
+		// is aggregated point by point, so growing geometrically makes
+		// the plate copied O(log n) instead of O(n) times.
+		const size_t x_slack = growthSlack(width, d_lft + d_rgt,
+			world_width);
+		const size_t y_slack = growthSlack(height, d_top + d_btm,
+			world_height);
+		d_lft += x_slack & -(d_lft > 0);
+		d_rgt += x_slack & -(d_lft == 0);
+		d_top += y_slack & -(d_top > 0);
+		d_btm += y_slack & -(d_top == 0);
+
 		// Make sure plate doesn't grow bigger than the system it's in!
-		if (width + d_lft + d_rgt > world_side)
+		if (width + d_lft + d_rgt > world_width)
 		{
 			d_lft = 0;
-			d_rgt = world_side - width;
+			d_rgt = world_width - width;
 		}
 
-		if (height + d_top + d_btm > world_side)
+		if (height + d_top + d_btm > world_height)
 		{
 			d_top = 0;
-			d_btm = world_side - height;
+			d_btm = world_height - height;
 		}
 
 		#ifdef DEBUG
@@ -741,9 +1165,9 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 			printf("[%u, %u]x[%u, %u], [%u, %u]/[%u, %u]\n",
 				(size_t)left, (size_t)top, (size_t)left+width,
 				(size_t)top+height,
-				x + world_side * (x < world_side),
-				y + world_side * (y < world_side),
-				x % world_side, y % world_side);
+				x + world_width * (x < world_width),
+				y + world_height * (y < world_height),
+				x % world_width, y % world_height);
 
 			puts("Index out of bounds, but nowhere to grow!");
 			exit(1);
@@ -752,13 +1176,14 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 
 		const size_t old_width = width;
 		const size_t old_height = height;
+		++extensions;
 		
 		left -= d_lft;
-		left += left >= 0 ? 0 : world_side;
+		left += left >= 0 ? 0 : world_width;
 		width += d_lft + d_rgt;
 
 		top -= d_top;
-		top += top >= 0 ? 0 : world_side;
+		top += top >= 0 ? 0 : world_height;
 		height += d_top + d_btm;
 
 //		printf("%ux%u + [%u,%u] + [%u, %u] = %ux%u\n",
@@ -766,11 +1191,11 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 //			d_lft, d_top, d_rgt, d_btm, width, height);
 
 		float* tmph = new float[width*height];
-		size_t* tmpa = new size_t[width*height];
-		size_t* tmps = new size_t[width*height];
+		uint32_t* tmpa = new uint32_t[width*height];
+		uint32_t* tmps = new uint32_t[width*height];
 		memset(tmph, 0, width*height*sizeof(float));
-		memset(tmpa, 0, width*height*sizeof(size_t));
-		memset(tmps, 255, width*height*sizeof(size_t));
+		memset(tmpa, 0, width*height*sizeof(uint32_t));
+		std::fill_n(tmps, width*height, NO_SEGMENT);
 
 		// copy old plate into new.
 		for (size_t j = 0; j < old_height; ++j)
@@ -780,9 +1205,9 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 			memcpy(&tmph[dest_i], &map[src_i], old_width *
 				sizeof(float));
 			memcpy(&tmpa[dest_i], &age[src_i], old_width *
-				sizeof(size_t));
+				sizeof(uint32_t));
 			memcpy(&tmps[dest_i], &segment[src_i], old_width *
-				sizeof(size_t));
+				sizeof(uint32_t));
 		}
 
 		delete[] map;
@@ -792,6 +1217,23 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 		age = tmpa;
 		segment = tmps;
 
+		// Move the known extents of crust along with the rows.
+		uint32_t* tmpx0 = new uint32_t[height];
+		uint32_t* tmpx1 = new uint32_t[height];
+		memset(tmpx0, 0, height*sizeof(uint32_t));
+		memset(tmpx1, 0, height*sizeof(uint32_t));
+
+		for (size_t j = 0; j < old_height; ++j)
+		{
+			tmpx0[d_top + j] = row_x0[j] + d_lft;
+			tmpx1[d_top + j] = row_x1[j] + d_lft;
+		}
+
+		delete[] row_x0;
+		delete[] row_x1;
+		row_x0 = tmpx0;
+		row_x1 = tmpx1;
+
 		// Shift all segment data to match new coordinates.
 		for (size_t s = 0; s < seg_data.size(); ++s)
 		{
@@ -811,7 +1253,7 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 				"[%u, %u]x[%u, %u], [%u, %u]/[%u, %u]\n",
 				(size_t)left, (size_t)top, (size_t)left+width,
 				(size_t)top+height,
-				x, y, x % world_side, y % world_side);
+				x, y, x % world_width, y % world_height);
 			exit(1);
 		}
 		#endif
@@ -828,6 +1270,20 @@ void plate::setCrust(size_t x, size_t y, float z, size_t t) throw()
 	mass -= map[index];
 	map[index] = z;		// Set new crust height to desired location.
 	mass += z;		// Update mass counter.
+
+	if (z > 0) // Make sure the new crust is within its row's extent.
+	{
+		if (row_x0[_y] >= row_x1[_y])
+		{
+			row_x0[_y] = _x;
+			row_x1[_y] = _x + 1;
+		}
+		else
+		{
+			row_x0[_y] = _x < row_x0[_y] ? _x : row_x0[_y];
+			row_x1[_y] = _x < row_x1[_y] ? row_x1[_y] : _x + 1;
+		}
+	}
 }
 
 void plate::selectCollisionSegment(size_t coll_x, size_t coll_y) throw()
@@ -983,7 +1439,7 @@ size_t plate::createSegment(size_t x, size_t y) throw()
 		}
 
 		// Check if should wrap around left edge.
-		if (width == world_side && start == 0 &&
+		if (width == world_width && start == 0 &&
 			segment[line_here+width-1] > ID &&
 			map[line_here+width-1] >= CONT_BASE)
 		{
@@ -995,7 +1451,7 @@ size_t plate::createSegment(size_t x, size_t y) throw()
 		}
 
 		// Check if should wrap around right edge.
-		if (width == world_side && end == width - 1 &&
+		if (width == world_width && end == width - 1 &&
 			segment[line_here+0] > ID &&
 			map[line_here+0] >= CONT_BASE)
 		{
@@ -1014,7 +1470,7 @@ size_t plate::createSegment(size_t x, size_t y) throw()
 		if (start < data.x0) data.x0 = start;
 		if (end > data.x1) data.x1 = end;
 
-		if (line > 0 || height == world_side)
+		if (line > 0 || height == world_height)
 		for (size_t j = start; j <= end; ++j)
 		  if (segment[line_above + j] > ID &&
 		      map[line_above + j] >= CONT_BASE)
@@ -1040,7 +1496,7 @@ size_t plate::createSegment(size_t x, size_t y) throw()
 			++j; // Skip the last scanned point.
 		  }
 
-		if (line < height - 1 || height == world_side)
+		if (line < height - 1 || height == world_height)
 		for (size_t j = start; j <= end; ++j)
 		  if (segment[line_below + j] > ID &&
 		      map[line_below + j] >= CONT_BASE)
@@ -1079,6 +1535,31 @@ size_t plate::createSegment(size_t x, size_t y) throw()
 	return ID;
 }
 
+void plate::updateRowExtents(size_t y0, size_t y1) throw()
+{
+	for (size_t y = y0; y < y1; ++y)
+	{
+		const float* row = &map[y * width];
+		size_t x0 = 0, x1 = width;
+
+		while (x0 < x1 && row[x0] <= 0) ++x0;
+		while (x1 > x0 && row[x1 - 1] <= 0) --x1;
+
+		// Segments are only looked for within the extent. Keep the
+		// points that drop out of it unsegmented.
+		const size_t old_x0 = row_x0[y];
+		const size_t old_x1 = row_x1[y];
+		uint32_t* const seg = &segment[y * width];
+		for (size_t x = old_x0; x < old_x1 && x < x0; ++x)
+			seg[x] = NO_SEGMENT;
+		for (size_t x = x1 > old_x0 ? x1 : old_x0; x < old_x1; ++x)
+			seg[x] = NO_SEGMENT;
+
+		row_x0[y] = x0;
+		row_x1[y] = x1;
+	}
+}
+
 size_t plate::getMapIndex(size_t* px, size_t* py) const throw()
 {
 	size_t x = *px;
@@ -1088,8 +1569,10 @@ size_t plate::getMapIndex(size_t* px, size_t* py) const throw()
 	const size_t irgt = ilft + width;
 	const size_t ibtm = itop + height;
 
-	x &= world_side - 1; // Sometimes input is beyond map dimensions.
-	y &= world_side - 1; // Scale it to fit within world map.
+	// Sometimes input is beyond map dimensions. Scale it to fit within
+	// world map.
+	x = wrapCoordinate(x, world_width);
+	y = wrapCoordinate(y, world_height);
 
 	///////////////////////////////////////////////////////////////////////
 	// If you think you're smart enough to optimize this then PREPARE to be
@@ -1097,17 +1580,17 @@ size_t plate::getMapIndex(size_t* px, size_t* py) const throw()
 	///////////////////////////////////////////////////////////////////////
 
 	const size_t xOkA = (x >= ilft) & (x < irgt);
-	const size_t xOkB = (x + world_side >= ilft) &
-	                      (x +world_side < irgt);
+	const size_t xOkB = (x + world_width >= ilft) &
+	                      (x +world_width < irgt);
 	const size_t xOk = xOkA | xOkB;
 
 	const size_t yOkA = (y >= itop) & (y < ibtm);
-	const size_t yOkB = (y + world_side >= itop) &
-	                      (y +world_side < ibtm);
+	const size_t yOkB = (y + world_height >= itop) &
+	                      (y +world_height < ibtm);
 	const size_t yOk = yOkA | yOkB;
 
-	x += world_side & -(x < ilft); // Point is within plate's map: wrap
-	y += world_side & -(y < itop); // it around world edges if necessary.
+	x += world_width & -(x < ilft); // Point is within plate's map: wrap
+	y += world_height & -(y < itop); // it around world edges if necessary.
 
 	x -= ilft; // Calculate offset within local map.
 	y -= itop;
@@ -1118,9 +1601,9 @@ size_t plate::getMapIndex(size_t* px, size_t* py) const throw()
 	if (failMask)
 	{
 		bool X_OK = (*px >= ilft && *px < irgt) || 
-			(*px+world_side >= ilft && *px+world_side < irgt);
+			(*px+world_width >= ilft && *px+world_width < irgt);
 		bool Y_OK = (*py >= itop && *py < ibtm) || 
-			(*py+world_side >= itop && *py+world_side < ibtm);
+			(*py+world_height >= itop && *py+world_height < ibtm);
 
 		if (X_OK && Y_OK)
 		{
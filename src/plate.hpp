@@ -2,8 +2,11 @@
 #define PLATE_HPP
 
 #include <cstring>
+#include <stdint.h>
 #include <vector>
 
+#include "MersenneTwister.h"
+
 #define CONT_BASE 1.0 ///< Height limit that separates seas from dry land.
 
 class plate
@@ -17,9 +20,11 @@ class plate
 	/// @param	h	Height of height map in pixels.
 	/// @param	_x	X of height map's left-top corner on world map.
 	/// @param	_y	Y of height map's left-top corner on world map.
-	/// @param	world_side Length of world map's either side in pixels.
+	/// @param	world_w	Width of world map in pixels.
+	/// @param	world_h	Height of world map in pixels.
+	/// @param	seed	Seed of plate's own random number stream.
 	plate(const float* m, size_t w, size_t h, size_t _x, size_t _y,
-	      size_t plate_age, size_t world_side)
+	      size_t plate_age, size_t world_w, size_t world_h, uint32_t seed)
 		throw();
 
 	~plate() throw(); ///< Default destructor for plate.
@@ -132,17 +137,29 @@ class plate
 	/// @param	y	Offset on the global world map along Y axis.
 	/// @return		Timestamp of creation of crust at the location.
 	///                     Zero is returned if location contains no crust.
-	size_t getCrustTimestamp(size_t x, size_t y) const throw();
+	uint32_t getCrustTimestamp(size_t x, size_t y) const throw();
 
 	/// Get pointers to plate's data.
 	///
 	/// @param	c	Adress of crust height map is stored here.
 	/// @param	t	Adress of crust timestamp map is stored here.
-	void getMap(const float** c, const size_t** t) const throw();
+	void getMap(const float** c, const uint32_t** t) const throw();
+
+	/// Get the columns of each row of plate's map that may have crust.
+	///
+	/// Row y of height map has no crust outside columns [x0[y], x1[y][.
+	/// The range is kept up to date as the crust changes so that it can be
+	/// reused every iteration, no matter how the plate moves. It may be
+	/// wider than necessary after crust has been removed from the plate.
+	///
+	/// @param	x0	Address of the first column of each row.
+	/// @param	x1	Address of one past the last column of each row.
+	void getRowExtents(const uint32_t** x0, const uint32_t** x1)
+		const throw();
 
 	void move() throw(); ///< Moves plate along it's trajectory.
 
-	/// Clear any earlier continental crust partitions.
+	/// Partition plate's continental crust into connected segments.
 	///
 	/// Plate has an internal bookkeeping of distinct areas of continental
 	/// crust for more realistic collision responce. However as the number
@@ -150,10 +167,11 @@ class plate
 	/// of a continent become more and more inaccurate. Finally it results
 	/// in striking artefacts that cannot overlooked.
 	///
-	/// To alleviate this problem without the need of per iteration
-	/// recalculations plate supplies caller a method to reset its
-	/// bookkeeping and start clean.
-	void resetSegments() throw();
+	/// To alleviate this problem the caller discards the bookkeeping once
+	/// per iteration with this method, which labels all continents anew
+	/// in two passes over the plate. Collisions then merely look segments
+	/// up. Crust that becomes continental later is segmented on demand.
+	void findSegments() throw();
 
 	/// Remember the currently processed continent's segment number.
 	///
@@ -179,6 +197,7 @@ class plate
 	float getVelX() const throw() { return vx; }
 	float getVelY() const throw() { return vy; }
 	size_t getWidth() const throw() { return width; }
+	size_t getExtensionCount() const throw() { return extensions; }
 	bool   isEmpty() const throw() { return mass <= 0; }
 
 	protected:
@@ -208,6 +227,23 @@ class plate
 	/// @return	ID of created segment on success, otherwise -1.
 	size_t createSegment(size_t wx, size_t wy) throw();
 
+	/// Erosion for plates that span the whole world and wrap around it.
+	///
+	/// @param	lower_bound Sets limit below which there's no erosion.
+	void erodeWrapping(float lower_bound) throw();
+
+	/// Calculate extra room to add when plate is extended.
+	///
+	/// @param	length	Plate's current size along the growing axis.
+	/// @param	growth	Amount of growth needed along the same axis.
+	/// @param	world_length World map's size along the same axis.
+	/// @return	Number of points to add on top of requested growth.
+	size_t growthSlack(size_t length, size_t growth, size_t world_length)
+		const throw();
+
+	/// Find again the columns of crust on rows [y0, y1[ of height map.
+	void updateRowExtents(size_t y0, size_t y1) throw();
+
 	/// Translate world coordinates into offset within plate's height map.
 	///
 	/// Iff the global world map coordinates are within plate's height map,
@@ -221,9 +257,13 @@ class plate
 	size_t getMapIndex(size_t* x, size_t* y) const throw();
 
 	float* map; ///< Bitmap of plate's structure/height.
-	size_t* age; ///< Bitmap of plate's soil's age: timestamp of creation.
+	uint32_t* age; ///< Bitmap of plate's soil's age: timestamp of creation.
+	uint32_t* row_x0; ///< First column of each row that may have crust.
+	uint32_t* row_x1; ///< One past the last column that may have crust.
 	size_t width, height; ///< Height map's dimensions along X and Y axis.
-	size_t world_side; ///< Container world map's either side in pixels.
+	size_t world_width; ///< Container world map's width in pixels.
+	size_t world_height; ///< Container world map's height in pixels.
+	size_t extensions; ///< Number of times the height map has grown.
 
 	float mass; ///< Amount of crust that constitutes the plate.
 	float left, top; ///< Height map's left-top corner in world coords.
@@ -233,9 +273,10 @@ class plate
 	float vx, vy; ///< X and Y components of plate's direction unit vector.
 	float dx, dy; ///< X and Y components of plate's acceleration vector.
 	float alpha; ///< Angle in the chage of direction in radians.
+	MTRand rng; ///< Random numbers of this plate only.
 
 	std::vector<segmentData> seg_data; ///< Details of each crust segment.
-	size_t* segment; ///< Segment ID of each piece of continental crust.
+	uint32_t* segment; ///< Segment ID of each piece of continental crust.
 	size_t activeContinent; ///< Segment ID of the cont. that's processed.
 };
 
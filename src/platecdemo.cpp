@@ -300,11 +300,6 @@ int main(int argc, char **argv)
 	CHECK_RANGE(l_arg, map_side, size_t, "%u", 'l', MIN_MAP_SIDE,
 		MAX_MAP_SIDE, DEFAULT_MAP_SIDE);
 
-	if (map_side & (map_side - 1))
-		printf("Length of map's side must be a power "
-		       "of two! Using default value %d.\n",
-		       map_side = DEFAULT_MAP_SIDE);
-
 	CHECK_RANGE(n_arg, num_plates, size_t, "%u", 'n', MIN_PLATES,
 		MAX_PLATES, DEFAULT_NUM_PLATES);
 
@@ -327,10 +322,9 @@ int main(int argc, char **argv)
 	       erosion_period, folding_ratio, aggr_overlap_abs,
 	       aggr_overlap_rel, cycle_count);
 
-	srand(time(0));
-
-	world = new lithosphere(map_side, sea_level, erosion_period,
-		folding_ratio, aggr_overlap_abs, aggr_overlap_rel, cycle_count);
+	world = new lithosphere(map_side, map_side, sea_level, erosion_period,
+		folding_ratio, aggr_overlap_abs, aggr_overlap_rel, cycle_count,
+		time(0));
 	world->createPlates(num_plates);
 
 	glutInit(&argc, argv);
@@ -4,179 +4,234 @@
  *  @author Lauri Viitanen
  *  @date 2011-08-09
  */
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "parallel.h"
 #include "sqrdmd.h"
 
-extern int sqrdmd(float* map, int size, float rgh)
+/** Smallest number of samples worth handing to another thread. */
+#define MIN_TASK_SAMPLES 8192
+
+/** Settings of the level being computed, shared by all of its rows. */
+struct sqrdmdLevel
+{
+	float* map;
+	int width, height; /* Lengths of map's sides, 2^x + 1 both. */
+	int step; /* Distance between corners of squares of this level. */
+	int rows_per_task;
+	float slope; /* Amount of randomness added to the averages. */
+	uint32_t key; /* Hash of seed and level, keys the random numbers. */
+};
+
+/* Finalizer of MurmurHash3, mixes all bits of 'h' into every bit. */
+static inline uint32_t mix(uint32_t h)
 {
-	const int full_size = size * size;
+	h ^= h >> 16; h *= 0x85EBCA6Bu;
+	h ^= h >> 13; h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
 
-	int i, temp;
-	int x, y, dx, dy;
-	int x0, x1, y0, y1;
-	int p0, p1, p2, p3;
-	int step, line_jump, masked;
-	float slope, sum, center_sum;
+/*
+ * Set every 'step'th sample of a row, starting from (x, y), to the average
+ * of its four neighbours plus some noise. Neighbours of the first sample
+ * are in 'a', 'b', 'c' and 'd', the others follow at the same distances.
+ * Random numbers are hashed from the level and the position of a sample,
+ * so the result doesn't depend on the order in which rows are processed.
+ */
+static void average(const struct sqrdmdLevel* l, float* out, const float* a,
+	const float* b, const float* c, const float* d, int count, int x, int y)
+{
+	const uint32_t first = (uint32_t)y * l->width + x;
+	const uint32_t key = l->key;
+	const float slope = l->slope;
+	const int step = l->step;
+	int k;
+
+	#pragma omp simd
+	for (k = 0; k < count; ++k)
+	{
+		const int i = k * step;
+		const int32_t noise = (int32_t)mix(mix(first + i) ^ key);
+		const float sum = (a[i] + b[i] + c[i] + d[i]) * 0.25f +
+		                  slope * (float)noise;
+
+		/* Values other than (almost) zero are left unmodified. */
+		const float old = out[i];
+		out[i] = old > -1.0f && old < 1.0f ? sum : old;
+	}
+}
 
-	i = 0;
-	temp = size - 1;
+/* Calculate midpoint of each sub square on a block of rows. */
+static void diamondRows(void* ctx, int task)
+{
+	const struct sqrdmdLevel* l = (const struct sqrdmdLevel*)ctx;
+	const int width = l->width, step = l->step, half = step >> 1;
+	const int count = (width - 1) / step;
+	const int rows = (l->height - 1) / step;
+	int r = task * l->rows_per_task;
+	int end = r + l->rows_per_task;
+
+	for (end = end < rows ? end : rows; r < end; ++r)
+	{
+		const int y = half + r * step;
+		float* row = l->map + y * width;
+		const float* up = row - half * width;
+		const float* down = row + half * width;
 
-	if (temp & (temp - 1) || temp & 3)  /* MUST EQUAL TO 2^x + 1! */
-		return (-1);
+		average(l, row + half, up, up + step, down, down + step,
+			count, half, y);
+	}
+}
 
-	temp = size;
-	slope = rgh;
-	step = size & ~1;
+/*
+ * Calculate center point of each sub diamond on a block of rows. Diamond
+ * gets its left and right vertices from the square corners of last level
+ * and its top and bottom vertices from the diamond step just performed,
+ * or the other way round. Neighbours above the top row and left of the
+ * leftmost column wrap around map edges.
+ */
+static void squareRows(void* ctx, int task)
+{
+	const struct sqrdmdLevel* l = (const struct sqrdmdLevel*)ctx;
+	const int width = l->width, step = l->step, half = step >> 1;
+	const int last = width - 1;
+	const int count = last / step;
+	const int rows = 2 * ((l->height - 1) / step);
+	int r = task * l->rows_per_task;
+	int end = r + l->rows_per_task;
+
+	for (end = end < rows ? end : rows; r < end; ++r)
+	{
+		const int y = r * half;
+		float* row = l->map + y * width;
+		const float* up = y ? row - half * width : l->map +
+			(l->height - 1 - half) * width;
+		const float* down = row + half * width;
 
-	#define CALC_SUM(a, b, c, d)\
-	do {\
-		sum = ((a) + (b) + (c) + (d)) * 0.25f;\
-		sum = sum + slope * ((rand() << 1) - RAND_MAX);\
-	} while (0)
+		if (r & 1) /* Odd rows start from the leftmost column. */
+		{
+			average(l, row, row + last - half, row + half, up, down,
+				1, 0, y);
+			average(l, row + step, row + half, row + step + half,
+				up + step, down + step, count - 1, step, y);
+		}
+		else /* Even rows start from half a step to the right. */
+			average(l, row + half, row, row + step, up + half,
+				down + half, count, half, y);
+	}
+}
 
-	#define SAVE_SUM(a)\
-	do {\
-		masked = !((int)map[a]);\
-		map[a] = map[a] * !masked + sum * masked;\
-	} while (0)
+/* Hand rows of a level to worker threads in blocks of reasonable size. */
+static void runRows(struct sqrdmdLevel* l, parallel_task task, int rows,
+	int row_samples)
+{
+	l->rows_per_task = 1 + MIN_TASK_SAMPLES / row_samples;
+	parallel_run((rows + l->rows_per_task - 1) / l->rows_per_task, task, l);
+}
 
-	/* Calculate midpoint ("diamond step"). */
-	dy = step * size;
-	CALC_SUM(map[0], map[step], map[dy], map[dy + step]);
-	SAVE_SUM(i);
+/*
+ * Fractal of a map of 'width' x 'height' points, both 2^x + 1. Coarsest
+ * squares are as large as the shorter side allows, so a map twice as wide
+ * as it is high starts from two of them.
+ */
+static int generate(float* map, int width, int height, float rgh,
+	unsigned int seed)
+{
+	const int last_x = width - 1, last_y = height - 1;
+	struct sqrdmdLevel l;
+	int i;
 
-	center_sum = sum;
+	if (last_x & (last_x - 1) || last_x & 3 ||  /* MUST EQUAL TO 2^x + 1! */
+	    last_y & (last_y - 1) || last_y & 3)
+		return (-1);
 
-	/* Calculate each sub diamonds' center points ("square step"). */
+	l.map = map;
+	l.width = width;
+	l.height = height;
+	l.slope = rgh;
 
-	/* Top row. */
-	p0 = step >> 1;
-	CALC_SUM(map[0], map[step], center_sum, center_sum);
-	SAVE_SUM(p0);
+	for (l.step = last_x < last_y ? last_x : last_y; l.step > 1;
+	     l.step >>= 1)
+	{
+		const int half = l.step >> 1;
+		const int count = last_x / l.step;
+		const int rows = last_y / l.step;
 
-	/* Left column. */
-	p1 = p0 * size;
-	CALC_SUM(map[0], map[dy], center_sum, center_sum);
-	SAVE_SUM(p1);
+		l.key = mix(seed ^ mix(l.step));
 
-	map[full_size + p0 - size] = map[p0];  /* Copy top value into bottom row. */
-	map[p1 + size - 1] = map[p1];  /* Copy left value into right column. */
+		runRows(&l, diamondRows, rows, count);
+		runRows(&l, squareRows, 2 * rows, count);
 
-	slope *= rgh;
-	step >>= 1;
+		/* Copy new values of top row into bottom row and values of
+		 * left column into right column. */
+		for (i = half; i < last_x; i += l.step)
+			map[last_y * width + i] = map[i];
+		for (i = half; i < last_y; i += l.step)
+			map[i * width + last_x] = map[i * width];
 
-	#undef SAVE_SUM
-	#undef CALC_SUM
+		l.slope *= rgh;  /* reduce the amount of randomness for next round */
+	}
 
-	while (step > 1)  /* Enter the main loop. */
-	{
-		/**********************************************************************
-		 * Calculate midpoint of each sub square on the map ("diamond step"). *
-		 **********************************************************************/
+	return (0);
+}
 
-		dx = step;
-		dy = step * size;
-		i = (step >> 1) * (size + 1);
-		line_jump = step * size + 1 + step - size;
+/* Smallest power of two that is at least 'length' and four. */
+static int coveringSide(int length)
+{
+	int side = 4;
+	while (side < length)
+		side <<= 1;
+	return side;
+}
 
-		for (y0 = 0, y1 = dy; y1 < size * size; y0 += dy, y1 += dy)
-		{
-			for (x0 = 0, x1 = dx; x1 < size; x0 += dx, x1 += dx, i += step)
-			{
-				sum = (map[y0+x0] + map[y0+x1] + map[y1+x0] + map[y1+x1]) * 0.25f;
-				sum = sum + slope * ((rand() << 1) - RAND_MAX);
-
-				masked = !((int)map[i]);
-				map[i] = map[i] * !masked + sum * masked;
-			}
-
-			/* There's additional step taken at the end of last valid loop.
-			 * That step actually isn't valid because the row ends right then.
-			 * Thus we are forced to manually remove it after the loop so that
-			 * 'i' points again to the index accessed last.
-			 */
-			i += line_jump - step;
-		}
+extern int sqrdmd_seeded(float* map, int size, float rgh, unsigned int seed)
+{
+	return generate(map, size, size, rgh, seed);
+}
 
-		/**********************************************************************
-		 * Calculate each sub diamonds' center point ("square step"). Diamond *
-		 * gets its left and right vertices from the square corners of last   *
-		 * iteration and its top and bottom vertices from the "diamond step"  *
-		 * we just performed.						 *
-		 **********************************************************************/
-
-		i = step >> 1;
-		p0 = step;  /* right */
-		p1 = i * size + i;  /* bottom */
-		p2 = 0;  /* left */
-		p3 = full_size + i - (i + 1) * size;  /* top (wraps around map edges) */
-
-		/* Calculate "diamond" values for top row in map. */
-		while (p0 < size)
-		{
-			sum = (map[p0] + map[p1] + map[p2] + map[p3]) * 0.25f;
-			sum = sum + slope * ((rand() << 1) - RAND_MAX);
+extern int sqrdmd_wrapped(float* map, int width, int height, float rgh,
+	unsigned int seed)
+{
+	const int side_x = coveringSide(width), side_y = coveringSide(height);
+	const size_t stride = side_x + 1;
+	float* tmp;
+	size_t* col;
+	int x, y, result = -1;
 
-			masked = !((int)map[i]);
-			map[i] = map[i] * !masked + sum * masked;
-			map[full_size + i - size] = map[i];  /* Copy it into bottom row. */
+	if (width < 1 || height < 1)
+		return (-1);
 
-			p0 += step; p1 += step; p2 += step; p3 += step; i += step;
-		}
+	tmp = (float*)calloc(stride * (side_y + 1), sizeof(float));
+	col = (size_t*)malloc(width * sizeof(size_t));
+	if (tmp && col && generate(tmp, side_x + 1, side_y + 1, rgh, seed) == 0)
+	{
+		/* Points are picked evenly, the nearest one to where each
+		 * point of the map falls on the larger grid. */
+		for (x = 0; x < width; ++x)
+			col[x] = ((size_t)x * side_x + width / 2) / width;
 
-		/* Now that top row's values are calculated starting from 'y = step >> 1'
-		 * both saves us from recalculating same things twice and guarantees
-		 * that data will not be read beyond top row of map. 'size - (step >> 1)'
-		 * guarantees that data will not be read beyond bottom row of map.
-		 */
-		for (y = step >> 1, temp = 0; y < size - (step >> 1);
-		y += step >> 1, temp = !temp)
+		for (y = 0; y < height; ++y)
 		{
-			p0 = step >> 1;  /* right */
-			p1 = p0 * size;  /* bottom */
-			p2 = -p0;  /* left */
-			p3 = -p1;  /* top */
-
-			/* For even rows add step/2. For odd rows add nothing. */
-			x = i = p0 * temp;  /* Initialize 'x' while it's easy. */
-			i += y * size;  /* Finally move 'i' into correct row. */
-
-			p0 += i;
-			p1 += i;
-			p2 += i + (size - 1) * !temp;  /* For odd rows p2 (left) wraps around map edges. */
-			p3 += i;
-
-			/* size - (step >> 1) guarantees that data will not be read beyond
-			 * rightmost column of map. */
-			for (; x < size - (step >> 1); x += step)
-			{
-				sum = (map[p0] + map[p1] + map[p2] + map[p3]) * 0.25f;
-				sum = sum + slope * ((rand() << 1) - RAND_MAX);
-
-				masked = !((int)map[i]);
-				map[i] = map[i] * !masked + sum * masked;
-
-				p0 += step;
-				p1 += step;
-				p2 += step;
-				p3 += step;
-				i += step;
-
-				/* if we start from leftmost column -> left point (p2) is going
-				 * over the right border -> wrap it around into the beginning of
-				 * previous rows left line. */
-				p2 -= (size - 1) * !x;
-			}
-
-			/* copy rows first element into its last */
-			i = y * size;
-			map[i + size - 1] = map[i];
+			const size_t row = ((size_t)y * side_y + height / 2) /
+				height;
+			const float* src = tmp + row * stride;
+			float* dst = map + (size_t)y * width;
+
+			for (x = 0; x < width; ++x)
+				dst[x] = src[col[x]];
 		}
 
-		slope *= rgh;  /* reduce the amount of randomness for next round */
-		step >>= 1;  /* split squares and diamonds in half */
+		result = 0;
 	}
 
-	return (0);
+	free(col);
+	free(tmp);
+	return (result);
+}
+
+extern int sqrdmd(float* map, int size, float rgh)
+{
+	return sqrdmd_seeded(map, size, rgh, (unsigned int)rand());
 }
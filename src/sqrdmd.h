@@ -18,6 +18,7 @@ extern "C" {
  *  The gradient between each element of smoothness of map can be controlled
  *  with 'rgh' parameter so that value 0.0f produces completely flat/smooth
  *  map and value 1.0f produces completely random (noise) map.
+ *  Random numbers are seeded with a single call to rand().
  *
  *  @param	map Destination array to store the results.
  *  @param	size Length of map's side: 2^x + 1, x = 1, 2, 3 ...
@@ -26,6 +27,41 @@ extern "C" {
  */
 extern int sqrdmd(float* map, int size, float rgh);
 
+/**
+ *  @brief Generates a two dimensional fractal height map from a seed.
+ *
+ *  Same as sqrdmd() but random numbers are derived from given seed and
+ *  the position of each value instead of rand(). Same seed produces the
+ *  same map regardless of the number of threads used to calculate it.
+ *
+ *  @param	map Destination array to store the results.
+ *  @param	size Length of map's side: 2^x + 1, x = 1, 2, 3 ...
+ *  @param	rgh Amount of roughness/randomness in the final map.
+ *  @param	seed Seed of random numbers.
+ *  @return	Returns zero on success.
+ */
+extern int sqrdmd_seeded(float* map, int size, float rgh, unsigned int seed);
+
+/**
+ *  @brief Generates a fractal height map of any size that wraps around.
+ *
+ *  Values are picked evenly from a map made by sqrdmd_seeded() whose sides
+ *  are the smallest powers of two that cover given ones, so the result
+ *  tiles seamlessly: its right edge continues from the left one and its
+ *  bottom edge from the top one. All of target array is overwritten. With
+ *  sides that are powers of two, the result is the same as the top-left
+ *  corner of sqrdmd_seeded()'s map of one more value per side.
+ *
+ *  @param	map Destination array of width * height values.
+ *  @param	width Length of map's rows, at least 1.
+ *  @param	height Number of rows in map, at least 1.
+ *  @param	rgh Amount of roughness/randomness in the final map.
+ *  @param	seed Seed of random numbers.
+ *  @return	Returns zero on success.
+ */
+extern int sqrdmd_wrapped(float* map, int width, int height, float rgh,
+	unsigned int seed);
+
 #ifdef	__cplusplus
 }
 #endif